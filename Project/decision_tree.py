@@ -9,6 +9,7 @@ from sklearn.model_selection import train_test_split
 from sklearn.metrics import mean_squared_error, confusion_matrix, accuracy_score
 from sklearn.preprocessing import LabelEncoder
 from matplotlib.backends.backend_pdf import PdfPages
+from export_model import export_tree
 
 source = "amplitude"
 depth = np.array(range(1, 21))
@@ -55,6 +56,7 @@ best_depth = depth[index_min_val_error]
 # Fitting a classifier to the training set using a decision tree with depth = best_depth
 clf = DecisionTreeClassifier(random_state=0, max_depth=best_depth)
 clf.fit(X_train, y_train)
+export_tree(clf, "tree_model.bin")
 y_pred = clf.predict(X_val)
 print("The accuracy of the predicted classes", clf.score(X_val, y_pred), end='\n')
 
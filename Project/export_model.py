@@ -0,0 +1,49 @@
+import struct
+import numpy as np
+
+# Writes the trained classifiers in the binary format the C++ Classifier
+# (parser/tasks/parser.cpp) loads, see the comment there. classes are the
+# labels in the order of the outputs.
+
+MAGIC = 0x314d4356  # "VCM1"
+MLP, LOGISTIC, TREE = 0, 1, 2
+
+# softmax doesn't change which output is the largest.
+ACTIVATIONS = {"identity": 0, "softmax": 0, "relu": 1, "logistic": 2, "tanh": 3}
+
+
+def header(f, kind, inputs, classes):
+    f.write(struct.pack("<IIII", MAGIC, kind, inputs, len(classes)))
+    f.write("".join(str(c) for c in classes).encode("ascii"))
+
+
+def export_mlp(reg, classes, path):
+    with open(path, "wb") as f:
+        header(f, MLP, reg.coefs_[0].shape[0], classes)
+        f.write(struct.pack("<I", len(reg.coefs_)))
+        for i, (w, b) in enumerate(zip(reg.coefs_, reg.intercepts_)):
+            last = i == len(reg.coefs_) - 1
+            activation = reg.out_activation_ if last else reg.activation
+            f.write(struct.pack("<III", w.shape[0], w.shape[1], ACTIVATIONS[activation]))
+            f.write(np.ascontiguousarray(w, dtype="<f4").tobytes())
+            f.write(np.ascontiguousarray(b, dtype="<f4").tobytes())
+
+
+def export_logistic(reg, path):
+    with open(path, "wb") as f:
+        header(f, LOGISTIC, reg.coef_.shape[1], reg.classes_)
+        f.write(struct.pack("<I", reg.coef_.shape[0]))
+        f.write(np.ascontiguousarray(reg.coef_, dtype="<f4").tobytes())
+        f.write(np.ascontiguousarray(reg.intercept_, dtype="<f4").tobytes())
+
+
+def export_tree(clf, path):
+    t = clf.tree_
+    with open(path, "wb") as f:
+        header(f, TREE, t.n_features, clf.classes_)
+        f.write(struct.pack("<I", t.node_count))
+        f.write(np.ascontiguousarray(t.children_left, dtype="<i4").tobytes())
+        f.write(np.ascontiguousarray(t.children_right, dtype="<i4").tobytes())
+        f.write(np.ascontiguousarray(t.feature, dtype="<i4").tobytes())
+        f.write(np.ascontiguousarray(t.threshold, dtype="<f8").tobytes())
+        f.write(np.ascontiguousarray(t.value[:, 0, :].argmax(axis=1), dtype="<u4").tobytes())
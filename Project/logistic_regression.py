@@ -6,6 +6,7 @@ from sklearn.linear_model import LogisticRegression
 from sklearn.metrics import accuracy_score, confusion_matrix
 from sklearn.model_selection import train_test_split
 from matplotlib.backends.backend_pdf import PdfPages
+from export_model import export_logistic
 
 source = "amplitude"
 
@@ -20,6 +21,7 @@ y_validate = y_validate.ravel()
 
 reg = LogisticRegression(solver='sag', max_iter=200)
 reg.fit(X_train, y_train)
+export_logistic(reg, "logistic_model.bin")
 
 y_prediction = reg.predict(X_validate)
 
@@ -7,6 +7,7 @@ from sklearn.neural_network import MLPRegressor
 from sklearn.metrics import accuracy_score, confusion_matrix, mean_squared_error
 from sklearn.model_selection import train_test_split
 from matplotlib.backends.backend_pdf import PdfPages
+from export_model import export_mlp
 
 source = "amplitude"
 le = LabelEncoder()
@@ -19,6 +20,7 @@ X_train, X_validate, y_train, y_validate = train_test_split(features, labels, \
 
 reg = MLPRegressor(hidden_layer_sizes=[20]*5, max_iter=100, random_state=42)
 reg.fit(X_train, y_train)
+export_mlp(reg, list(labels.columns), "NN_model.bin")
 
 y_prediction = reg.predict(X_validate)
 
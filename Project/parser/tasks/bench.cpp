@@ -0,0 +1,972 @@
+#define PARSER_NO_MAIN
+#define COUNT_ALLOCATIONS
+#include "parser.cpp"
+
+/*****************************************************************************/
+// benchmarks /////////////////////////////////////////////////////////////////
+/*****************************************************************************/
+
+// micro-benchmarks for the hot parts of the parser. Compile it like the
+// parser (dev/compile bench) so the numbers use the same flags.
+
+namespace bench {
+
+using std::vector;
+
+// synthetic voice: harmonics with 1/k amplitudes, the pitch gliding from
+// f0 to f1 over the whole length, and a little noise.
+vector<float> voice(unsigned rate, float f0, float f1, float seconds){
+
+    std::mt19937 rng(1337);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+
+    unsigned n = rate * seconds;
+    vector<float> waves(n);
+
+    double phase = 0.0;
+    for(unsigned i=0; i<n; i++){
+        float f = f0 + (f1 - f0) * i / n;
+        phase += f / rate;
+        float x = 0.0f;
+        for(unsigned k=1; k<=10; k++) x += std::sin(2.0 * PI * k * phase) / k;
+        waves[i] = 0.2f * x + noise(rng);
+    }
+
+    return waves;
+}
+
+// results are accumulated here so the timed calls can't be optimized away.
+volatile unsigned sink = 0;
+
+template<class F>
+double time_ns(F f, unsigned repeats){
+    auto begin = std::chrono::steady_clock::now();
+    for(unsigned i=0; i<repeats; i++) f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / repeats;
+}
+
+// the peak search as it was before: the surrounding window kept in a multiset.
+unsigned multiset_peak(const float *mse, unsigned size, unsigned low, unsigned high,
+        unsigned window, float cutoff, float &value){
+
+    unsigned top = 0;
+
+    std::multiset<float> s;
+    for(unsigned i=0; i<=2*window && i<size; i++) s.insert(mse[i]);
+
+    value = 1.0f;
+    for(unsigned i=window; i<=high && i+window+1<size; i++){
+
+        if(mse[i] == *s.begin() && i >= low && mse[i] < value){
+            value = mse[i];
+            top = i;
+            if(value < cutoff) break;
+        }
+
+        s.erase(s.find(mse[i-window]));
+        s.insert(mse[i+window+1]);
+    }
+
+    return top;
+}
+
+void peak_search(){
+
+    struct Config { unsigned rate; float lower, upper; };
+    const Config configs[] = {{16000, 60, 900}, {22050, 60, 900}, {44100, 60, 900}, {48000, 40, 1000}};
+
+    std::cout << "peak search, ns per call\n";
+    std::cout << "  rate   size  multiset    scan  speedup  agree\n";
+
+    for(auto c : configs){
+
+        // momentum mse curves of a detector following the voice.
+
+        change::Detector detector(c.rate, c.lower, c.upper);
+        auto waves = voice(c.rate, 110.0f, 330.0f, 2.0f);
+
+        vector<vector<float> > curves;
+        vector<float> hop(128);
+        for(unsigned i=0; i+128<=waves.size(); i+=128){
+            std::copy(waves.begin()+i, waves.begin()+i+128, hop.begin());
+            detector.feed(hop);
+            if(!detector.quiet) curves.push_back(detector.get_mse());
+        }
+
+        unsigned size = detector.size;
+        unsigned low = std::floor(c.rate / c.upper), high = std::ceil(c.rate / c.lower);
+        unsigned window = std::min(low/2, detector.peakWindowMax);
+        float cutoff = detector.minCutoff;
+
+        unsigned agree = 0;
+        for(auto &m : curves){
+            float a, b;
+            agree += multiset_peak(m.data(), size, low, high, window, cutoff, a)
+                == change::find_peak(m.data(), size, low, high, window, cutoff, b) && a == b;
+        }
+
+        unsigned repeats = 20;
+        double old = time_ns([&]{
+            float v;
+            for(auto &m : curves) sink += multiset_peak(m.data(), size, low, high, window, cutoff, v);
+        }, repeats) / curves.size();
+
+        double now = time_ns([&]{
+            float v;
+            for(auto &m : curves) sink += change::find_peak(m.data(), size, low, high, window, cutoff, v);
+        }, repeats) / curves.size();
+
+        std::cout << std::setw(6) << c.rate << std::setw(7) << size
+            << std::setw(10) << std::setprecision(0) << std::fixed << old
+            << std::setw(8) << now
+            << std::setw(8) << std::setprecision(1) << old / now << "x"
+            << std::setw(5) << agree << "/" << curves.size() << '\n';
+    }
+}
+
+// feeds a detector in every mode and counts the allocations once it is warm.
+// returns the number of modes that allocated.
+unsigned feed_allocations(){
+
+    struct Mode { const char *name; bool incremental; unsigned trustLimit, decimation; };
+    const Mode modes[] = {{"fft", 0, ~0u, 1}, {"incremental", 1, ~0u, 1}, {"cross", 0, 0, 1},
+        {"cross incremental", 1, 0, 1}, {"coarse", 0, 5, 4}};
+
+    auto waves = voice(44100, 110.0f, 330.0f, 2.0f);
+
+    std::cout << "allocations per feed in steady state\n";
+
+    unsigned failed = 0;
+    for(auto m : modes){
+
+        change::Detector detector;
+        detector.incremental = m.incremental;
+        detector.trustLimit = m.trustLimit;
+        detector.decimation = m.decimation;
+
+        // the first rounds fill the buffer and the lag states.
+        vector<float> hop(128);
+        unsigned warm = 4 * detector.size / 128, hops = 0;
+        uint64_t before = 0;
+
+        for(unsigned i=0; i+128<=waves.size(); i+=128, hops++){
+            if(hops == warm) before = debug::allocations;
+            std::copy(waves.begin()+i, waves.begin()+i+128, hop.begin());
+            detector.feed(hop);
+        }
+
+        uint64_t count = debug::allocations - before;
+        failed += count != 0;
+
+        std::cout << "  " << std::setw(18) << std::left << m.name << std::right
+            << count << " in " << hops - warm << " feeds\n";
+    }
+
+    // reusing a detector for the same rate keeps its memory.
+    change::Detector detector;
+    uint64_t before = debug::allocations;
+    detector.reset(44100);
+    uint64_t count = debug::allocations - before;
+    failed += count != 0;
+    std::cout << "  " << std::setw(18) << std::left << "reset" << std::right << count << '\n';
+
+    return failed;
+}
+
+// lanes streams through one bank vs. a Detector per stream. The detectors
+// never build trust so they follow the same path as the bank.
+void detector_bank(){
+
+    const unsigned rate = 44100, hop = 128;
+
+    std::cout << "detector bank, us per stream per feed\n";
+    std::cout << " lanes  detectors    bank  speedup  voiced-agree  pitch-within-0.1%\n";
+
+    for(unsigned lanes : {1, 4, 8, 16}){
+
+        // every stream glides over a different range. the last one is silent.
+
+        vector<vector<float> > streams;
+        for(unsigned k=0; k<lanes; k++){
+            streams.push_back(voice(rate, 90.0f + 20.0f * k, 250.0f + 15.0f * k, 1.0f));
+            if(k && k == lanes-1) std::fill(streams[k].begin(), streams[k].end(), 0.0f);
+        }
+
+        unsigned hops = streams[0].size() / hop;
+
+        vector<float> interleaved(hop * lanes);
+        vector<float> single(hop);
+
+        change::DetectorBank bank(lanes, rate);
+        vector<change::Detector> detectors(lanes, change::Detector(rate));
+        for(auto &d : detectors) d.trustLimit = ~0u;
+
+        unsigned agree = 0, close = 0, voicedBoth = 0;
+
+        for(unsigned h=0; h<hops; h++){
+
+            for(unsigned i=0; i<hop; i++)
+                for(unsigned k=0; k<lanes; k++) interleaved[i*lanes + k] = streams[k][h*hop + i];
+
+            bank.feed(interleaved);
+
+            for(unsigned k=0; k<lanes; k++){
+                std::copy(streams[k].begin() + h*hop, streams[k].begin() + (h+1)*hop, single.begin());
+                detectors[k].feed(single);
+
+                agree += bank.voiced[k] == detectors[k].voiced;
+                if(bank.voiced[k] && detectors[k].voiced){
+                    voicedBoth++;
+                    close += std::abs(bank.pitch[k] - detectors[k].pitch) <= 1e-3f * detectors[k].pitch;
+                }
+            }
+        }
+
+        unsigned repeats = 3;
+        double separate = time_ns([&]{
+            for(unsigned h=0; h<hops; h++){
+                for(unsigned k=0; k<lanes; k++){
+                    std::copy(streams[k].begin() + h*hop, streams[k].begin() + (h+1)*hop, single.begin());
+                    detectors[k].feed(single);
+                    sink += detectors[k].period;
+                }
+            }
+        }, repeats) / hops / lanes / 1000;
+
+        double batched = time_ns([&]{
+            for(unsigned h=0; h<hops; h++){
+                for(unsigned i=0; i<hop; i++)
+                    for(unsigned k=0; k<lanes; k++) interleaved[i*lanes + k] = streams[k][h*hop + i];
+                bank.feed(interleaved);
+                sink += bank.period[0];
+            }
+        }, repeats) / hops / lanes / 1000;
+
+        std::cout << std::setw(6) << lanes
+            << std::setw(11) << std::setprecision(1) << std::fixed << separate
+            << std::setw(8) << batched
+            << std::setw(8) << separate / batched << "x"
+            << std::setw(9) << agree << "/" << hops * lanes
+            << std::setw(13) << close << "/" << voicedBoth << '\n';
+    }
+}
+
+// coarse to fine vs. exhaustive search on the voice, whose pitch is known.
+// the estimate of a feed belongs to the middle of the latest window.
+void coarse_search(){
+
+    const unsigned rate = 44100, hop = 128;
+    const float f0 = 110.0f, f1 = 330.0f, seconds = 2.0f;
+
+    auto waves = voice(rate, f0, f1, seconds);
+    unsigned hops = waves.size() / hop;
+
+    std::cout << "coarse to fine search, 44100 Hz, us per feed\n";
+    std::cout << "  decimation  refine   feed  median-error  within-1%  agree-with-exhaustive\n";
+
+    struct Mode { unsigned decimation; bool refine; };
+    const Mode modes[] = {{1, 1}, {2, 1}, {4, 1}, {4, 0}, {8, 1}};
+
+    vector<float> exhaustive(hops, 0.0f);
+
+    for(auto m : modes){
+
+        change::Detector detector(rate);
+        detector.decimation = m.decimation;
+        detector.refine = m.refine;
+
+        vector<float> chunk(hop), errors;
+        unsigned agree = 0;
+
+        for(unsigned h=0; h<hops; h++){
+
+            std::copy(waves.begin() + h*hop, waves.begin() + (h+1)*hop, chunk.begin());
+            detector.feed(chunk);
+
+            float pitch = detector.voiced ? detector.pitch : 0.0f;
+            if(m.decimation == 1) exhaustive[h] = pitch;
+            agree += (pitch == 0.0f) == (exhaustive[h] == 0.0f)
+                && std::abs(pitch - exhaustive[h]) <= 0.01f * exhaustive[h];
+
+            double t = (h + 1.0) * hop - detector.size / 2.0;
+            if(t < 0.0 || !detector.voiced) continue;
+
+            float truth = f0 + (f1 - f0) * t / waves.size();
+            errors.push_back(std::abs(pitch - truth) / truth);
+        }
+
+        std::sort(errors.begin(), errors.end());
+        unsigned within = std::lower_bound(errors.begin(), errors.end(), 0.01f) - errors.begin();
+
+        detector.reset();
+        double us = time_ns([&]{
+            for(unsigned h=0; h<hops; h++){
+                std::copy(waves.begin() + h*hop, waves.begin() + (h+1)*hop, chunk.begin());
+                detector.feed(chunk);
+                sink += detector.period;
+            }
+        }, 3) / hops / 1000;
+
+        std::cout << std::setw(12) << m.decimation << std::setw(8) << m.refine
+            << std::setw(7) << std::setprecision(1) << std::fixed << us
+            << std::setw(13) << std::setprecision(2) << 100.0f * errors[errors.size() / 2] << "%"
+            << std::setw(7) << within << "/" << errors.size()
+            << std::setw(14) << agree << "/" << hops << '\n';
+    }
+}
+
+// the voice pushed in 10 ms chunks like an audio callback would. The
+// estimates are checked against the pitch at their timestamps.
+void realtime(){
+
+    const unsigned rate = 44100, chunk = 441;
+    const float f0 = 110.0f, f1 = 330.0f, seconds = 2.0f;
+
+    auto waves = voice(rate, f0, f1, seconds);
+
+    std::cout << "realtime, 44100 Hz, hop 128, 10 ms chunks\n";
+    std::cout << "  lookahead  budget-us  estimates  misses  mean-us  max-us  latency-ms"
+        "  median-error  monotonic\n";
+
+    // a negative budget keeps the default.
+    struct Mode { unsigned lookahead; float budget; };
+    const Mode modes[] = {{0, 0.0f}, {735, 0.0f}, {735, -1.0f}, {735, 40.0f}};
+
+    for(auto m : modes){
+
+        change::RealtimeDetector detector(rate, 128, m.lookahead);
+        if(m.budget >= 0.0f) detector.budget = m.budget;
+
+        vector<change::Estimate> estimates;
+        estimates.reserve(waves.size() / 128 + 1);
+
+        for(unsigned i=0; i<waves.size(); i+=chunk){
+            detector.push(waves.data() + i, std::min(chunk, (unsigned)waves.size() - i), estimates);
+        }
+
+        vector<float> errors;
+        bool monotonic = 1;
+        for(unsigned i=0; i<estimates.size(); i++){
+            auto &e = estimates[i];
+            if(i) monotonic &= e.sample > estimates[i-1].sample;
+            if(!e.voiced) continue;
+            float truth = f0 + (f1 - f0) * e.sample / waves.size();
+            errors.push_back(std::abs(e.pitch - truth) / truth);
+        }
+        std::sort(errors.begin(), errors.end());
+
+        std::cout << std::setw(11) << m.lookahead << std::setw(11) << std::setprecision(0)
+            << std::fixed << detector.budget
+            << std::setw(11) << estimates.size() << std::setw(8) << detector.misses
+            << std::setw(9) << std::setprecision(1) << detector.totalMicros / detector.hops
+            << std::setw(8) << detector.maxMicros
+            << std::setw(12) << std::setprecision(2) << detector.latency_ms()
+            << std::setw(13) << 100.0f * errors[errors.size() / 2] << "%"
+            << std::setw(11) << (monotonic ? "yes" : "no") << '\n';
+    }
+}
+
+// the realtime detector forced down to the coarsest level for a second and
+// then straight back up to the full search, next to one that never degrades.
+// The pitch steps from 110 to 260 Hz while the search is coarse, so state
+// left over from before the degradation shows up after the recovery. Both
+// see the same hops, and once the full search is back the estimates should
+// continue the undegraded ones. Returns 1 if they don't settle.
+unsigned recovery(){
+
+    const unsigned rate = 44100, chunk = 441;
+
+    auto waves = voice(rate, 110.0f, 110.0f, 1.5f);
+    auto high = voice(rate, 260.0f, 260.0f, 1.5f);
+    waves.insert(waves.end(), high.begin(), high.end());
+
+    change::RealtimeDetector reference(rate, 128), degraded(rate, 128);
+    reference.budget = degraded.budget = 0.0f;
+    degraded.recoverAfter = 1;
+
+    vector<change::Estimate> a, b;
+    unsigned lowest = 0, recovered = 0;
+
+    for(unsigned i=0; i<waves.size(); i+=chunk){
+
+        unsigned n = std::min(chunk, (unsigned)waves.size() - i);
+        reference.push(waves.data() + i, n, a);
+        degraded.push(waves.data() + i, n, b);
+
+        lowest = std::max(lowest, degraded.level);
+        if(i >= rate) degraded.budget = 1e-3f;
+        if(i >= 2 * rate) degraded.budget = 1e9f;
+        if(lowest && degraded.level == 0 && !recovered) recovered = b.size();
+    }
+
+    // hops after the recovery until the estimates agree for good, and the
+    // largest jump between consecutive voiced estimates after it.
+    unsigned settle = recovered, disagree = 0;
+    float jump = 0.0f;
+
+    for(unsigned k=recovered; k<b.size() && k<a.size(); k++){
+
+        bool agree = a[k].voiced == b[k].voiced
+            && std::abs(a[k].pitch - b[k].pitch) <= 0.01f * a[k].pitch;
+        if(!agree){
+            disagree++;
+            settle = k + 1;
+        }
+
+        if(k && b[k].voiced && b[k-1].voiced){
+            jump = std::max(jump, std::abs(b[k].pitch - b[k-1].pitch) / b[k-1].pitch);
+        }
+    }
+
+    unsigned size = change::Detector(rate).size;
+    bool failed = lowest + 1 != change::RealtimeDetector::levels
+        || settle - recovered > 2 * size / 128 || jump > 0.05f;
+
+    std::cout << "recovery from level " << lowest << " to 0 at hop " << recovered
+        << ": settled after " << settle - recovered << " hops, " << disagree
+        << " disagree, largest jump " << std::setprecision(2) << std::fixed << 100.0f * jump
+        << "%" << (failed ? "  FAILED" : "") << '\n';
+
+    return failed;
+}
+
+// offline tracker vs. the detector on the voice, and on a noisy version of it
+// where octave errors are more likely.
+void tracker(){
+
+    const unsigned rate = 44100, hop = 128;
+    const float f0 = 110.0f, f1 = 330.0f, seconds = 4.0f;
+
+    std::cout << "offline tracker, 4 s at 44100 Hz\n";
+    std::cout << "  signal      method      ms  median-error  octave-errors  voiced\n";
+
+    for(unsigned noisy=0; noisy<2; noisy++){
+
+        auto waves = voice(rate, f0, f1, seconds);
+        if(noisy){
+            std::mt19937 rng(7);
+            std::normal_distribution<float> noise(0.0f, 0.1f);
+            for(float &x : waves) x += noise(rng);
+        }
+
+        auto truth = [&](double sample) -> float {
+            return f0 + (f1 - f0) * sample / waves.size();
+        };
+
+        auto report = [&](const char *method, double ms, vector<std::pair<double, float> > &voiced,
+                unsigned total){
+
+            vector<float> errors;
+            unsigned octaves = 0;
+            for(auto [sample, pitch] : voiced){
+                float f = truth(sample);
+                errors.push_back(std::abs(pitch - f) / f);
+                octaves += std::abs(std::log2(pitch / f)) > 0.5f;
+            }
+            std::sort(errors.begin(), errors.end());
+
+            std::cout << "  " << std::setw(8) << std::left << (noisy ? "noisy" : "voice")
+                << "  " << std::setw(10) << method << std::right
+                << std::setw(6) << std::setprecision(0) << std::fixed << ms
+                << std::setw(13) << std::setprecision(2)
+                << (errors.empty() ? 0.0f : 100.0f * errors[errors.size() / 2]) << "%"
+                << std::setw(15) << octaves
+                << std::setw(8) << voiced.size() << "/" << total << '\n';
+        };
+
+        {
+            change::Detector detector(rate);
+            vector<float> chunk(hop);
+            vector<std::pair<double, float> > voiced;
+            unsigned total = 0;
+
+            auto begin = std::chrono::steady_clock::now();
+            for(unsigned i=0; i+hop<=waves.size(); i+=hop){
+                std::copy(waves.begin() + i, waves.begin() + i + hop, chunk.begin());
+                detector.feed(chunk);
+                if(detector.position() < 0) continue;
+                total++;
+                if(detector.voiced) voiced.push_back({(double)detector.position(), detector.pitch});
+            }
+            auto end = std::chrono::steady_clock::now();
+
+            report("detector", std::chrono::duration<double, std::milli>(end - begin).count(),
+                    voiced, total);
+        }
+
+        for(unsigned threads : {1u, 0u}){
+
+            change::Tracker tracker(rate, hop);
+            tracker.threads = threads;
+
+            auto begin = std::chrono::steady_clock::now();
+            auto track = tracker.track(waves);
+            auto end = std::chrono::steady_clock::now();
+
+            vector<std::pair<double, float> > voiced;
+            for(auto &e : track) if(e.voiced) voiced.push_back({(double)e.sample, e.pitch});
+
+            report(threads ? "tracker 1" : "tracker", std::chrono::duration<double, std::milli>(end - begin).count(),
+                    voiced, track.size());
+        }
+    }
+}
+
+// a recording that is mostly silence: 1 s of voice between 1 s and 2 s of
+// background noise loud enough to not count as quiet for the detector. The
+// detector runs on all of it vs. only on the prescan regions, with the
+// default levels and with levels relative to the noise floor.
+void prescan(){
+
+    const unsigned rate = 44100, hop = 128;
+
+    std::mt19937 rng(3);
+    std::normal_distribution<float> hiss(0.0f, 1e-2f);
+
+    vector<float> waves(4 * rate);
+    for(float &x : waves) x = hiss(rng);
+    auto speech = voice(rate, 150.0f, 200.0f, 1.0f);
+    for(unsigned i=0; i<speech.size(); i++) waves[rate + i] += speech[i];
+
+    std::cout << "prescan, 4 s with 1 s of voice\n";
+    std::cout << "  levels    skipped  regions  envelope-MB/s  detector-ms  voiced-kept\n";
+
+    change::Detector detector(rate);
+    vector<float> chunk(hop);
+
+    vector<uint8_t> full(waves.size() / hop, 0);
+    double all = time_ns([&]{
+        detector.reset();
+        for(unsigned h=0; (h+1)*hop<=waves.size(); h++){
+            std::copy(waves.begin() + h*hop, waves.begin() + (h+1)*hop, chunk.begin());
+            detector.feed(chunk);
+            full[h] = detector.voiced;
+        }
+    }, 3) / 1e6;
+
+    std::cout << "  none" << std::setw(34) << std::setprecision(1) << std::fixed << all << '\n';
+
+    for(unsigned relative=0; relative<2; relative++){
+
+        change::Prescan scan;
+        scan.pad = 2 * detector.size + hop;
+        if(relative){
+            scan.enterOverFloor = 10.0f;
+            scan.exitOverFloor = 4.0f;
+        }
+
+        vector<change::Region> regions;
+        double envelope = time_ns([&]{ regions = scan.scan(waves); }, 20) / 1e6;
+
+        vector<uint8_t> skipping(waves.size() / hop, 0);
+        double some = time_ns([&]{
+            regions = scan.scan(waves);
+            for(auto r : regions){
+                detector.reset();
+                for(uint64_t at = r.begin / hop * hop; at < r.end && at + hop <= waves.size(); at += hop){
+                    std::copy(waves.begin() + at, waves.begin() + at + hop, chunk.begin());
+                    detector.feed(chunk);
+                    skipping[at / hop] = detector.voiced;
+                }
+            }
+        }, 3) / 1e6;
+
+        unsigned voiced = 0, kept = 0;
+        for(unsigned h=0; h<full.size(); h++){
+            voiced += full[h];
+            kept += full[h] && skipping[h];
+        }
+
+        std::cout << "  " << std::setw(8) << std::left << (relative ? "floor" : "default") << std::right
+            << std::setw(8) << std::setprecision(1) << 100.0f * scan.skipped << "%"
+            << std::setw(9) << regions.size()
+            << std::setw(15) << std::setprecision(0) << waves.size() * sizeof(float) / envelope / 1e3
+            << std::setw(13) << std::setprecision(1) << some
+            << std::setw(9) << kept << "/" << voiced << '\n';
+    }
+}
+
+// one long recording, sequential vs. split into segments on all the cores.
+// Returns 1 if either track changes with the number of threads.
+unsigned segmented(){
+
+    const unsigned rate = 44100;
+
+    vector<float> waves;
+    for(unsigned i=0; i<10; i++){
+        auto part = voice(rate, 100.0f + 10.0f * i, 250.0f - 10.0f * i, 3.0f);
+        waves.insert(waves.end(), part.begin(), part.end());
+    }
+
+    // one segment, on one worker whatever the threads are.
+    change::SegmentedDetector sequential;
+    sequential.segment = 0;
+
+    change::SegmentedDetector parallel;
+    parallel.segment = 5 * rate;
+
+    vector<change::Estimate> a, b;
+    double one = time_ns([&]{ a = sequential.track(waves); }, 1) / 1e6;
+    double all = time_ns([&]{ b = parallel.track(waves); }, 1) / 1e6;
+
+    // the same segments on any number of threads must give the very same track.
+    auto identical = [](const vector<change::Estimate> &x, const vector<change::Estimate> &y) -> bool {
+        if(x.size() != y.size()) return 0;
+        for(unsigned i=0; i<x.size(); i++){
+            if(x[i].sample != y[i].sample || x[i].pitch != y[i].pitch || x[i].voiced != y[i].voiced) return 0;
+        }
+        return 1;
+    };
+
+    bool same = 1;
+    for(unsigned threads : {1u, 3u}){
+        parallel.threads = sequential.threads = threads;
+        same &= identical(b, parallel.track(waves));
+        same &= identical(a, sequential.track(waves));
+    }
+
+    unsigned voiced = 0, close = 0, exact = 0;
+    for(unsigned i=0; i<a.size() && i<b.size(); i++){
+        voiced += a[i].voiced == b[i].voiced;
+        close += std::abs(a[i].pitch - b[i].pitch) <= 0.01f * a[i].pitch;
+        exact += a[i].pitch == b[i].pitch && a[i].voiced == b[i].voiced;
+    }
+
+    std::cout << "segmented, 30 s, " << std::max(1u, std::thread::hardware_concurrency())
+        << " thread(s), 5 s segments\n" << std::setprecision(1) << std::fixed
+        << "  sequential " << one << " ms, segmented " << all << " ms, "
+        << one / all << "x\n"
+        << "  hops " << a.size() << "/" << b.size() << ", voicing agrees " << voiced
+        << ", pitch within 1% " << close << ", identical " << exact << '\n'
+        << "  both identical on 1 and 3 threads: " << (same ? "yes" : "no  FAILED") << '\n';
+
+    return !same;
+}
+
+// compile time sizes vs. the runtime Detector on the same input. The
+// estimates must be identical, returns 1 if they aren't.
+unsigned fixed_detector(){
+
+    const unsigned rate = 44100, hop = 128;
+
+    auto waves = voice(rate, 110.0f, 330.0f, 2.0f);
+    unsigned hops = waves.size() / hop;
+
+    change::Detector dynamic(rate);
+    change::FixedDetector<rate> fixed;
+    vector<float> chunk(hop);
+
+    unsigned identical = 0;
+    for(unsigned h=0; h<hops; h++){
+        std::copy(waves.begin() + h*hop, waves.begin() + (h+1)*hop, chunk.begin());
+        dynamic.feed(chunk);
+        fixed.feed(chunk);
+        identical += dynamic.pitch == fixed.pitch && dynamic.voiced == fixed.voiced
+            && dynamic.confidence == fixed.confidence;
+    }
+
+    auto time = [&](change::Detector &detector) -> double {
+        detector.reset();
+        return time_ns([&]{
+            for(unsigned h=0; h<hops; h++){
+                std::copy(waves.begin() + h*hop, waves.begin() + (h+1)*hop, chunk.begin());
+                detector.feed(chunk);
+                sink += detector.period;
+            }
+        }, 3) / hops / 1000;
+    };
+
+    double a = time(dynamic), b = time(fixed);
+
+    std::cout << "fixed detector, 44100 Hz, us per feed\n" << std::setprecision(1) << std::fixed
+        << "  Detector " << a << ", FixedDetector " << b << ", " << a / b << "x"
+        << ", identical " << identical << "/" << hops << (identical == hops ? "" : "  FAILED") << '\n';
+
+    return identical != hops;
+}
+
+// 16 bit input: the float Detector on converted samples vs. the IntegerDetector
+// fed the interleaved channels of a 4 channel block in place.
+void integer_detector(){
+
+    const unsigned rate = 44100, hop = 128, channels = 4;
+
+    auto waves = voice(rate, 110.0f, 330.0f, 2.0f);
+    unsigned hops = waves.size() / hop;
+
+    // channel k is the voice at gain 1 / (k + 1).
+    vector<int16_t> block(waves.size() * channels);
+    for(unsigned i=0; i<waves.size(); i++){
+        for(unsigned k=0; k<channels; k++){
+            block[i*channels + k] = std::lrint(std::max(-1.0f, std::min(1.0f, waves[i])) * 32767 / (k + 1));
+        }
+    }
+
+    vector<change::Detector> floats(channels, change::Detector(rate));
+    vector<change::IntegerDetector> ints(channels, change::IntegerDetector(rate));
+    vector<float> chunk(hop);
+
+    unsigned voiced = 0, close = 0;
+    for(unsigned h=0; h<hops; h++){
+        for(unsigned k=0; k<channels; k++){
+            const int16_t *x = block.data() + h*hop*channels + k;
+            for(unsigned i=0; i<hop; i++) chunk[i] = x[i*channels] / 32768.0f;
+            floats[k].feed(chunk);
+            ints[k].feed(x, hop, channels);
+            voiced += floats[k].voiced == ints[k].voiced;
+            close += std::abs(floats[k].pitch - ints[k].pitch) <= 0.001f * floats[k].pitch;
+        }
+    }
+
+    for(auto &d : floats) d.reset();
+    for(auto &d : ints) d.reset();
+
+    double a = time_ns([&]{
+        for(unsigned h=0; h<hops; h++){
+            for(unsigned k=0; k<channels; k++){
+                const int16_t *x = block.data() + h*hop*channels + k;
+                for(unsigned i=0; i<hop; i++) chunk[i] = x[i*channels] / 32768.0f;
+                floats[k].feed(chunk);
+                sink += floats[k].period;
+            }
+        }
+    }, 3) / hops / channels / 1000;
+
+    double b = time_ns([&]{
+        for(unsigned h=0; h<hops; h++){
+            for(unsigned k=0; k<channels; k++){
+                ints[k].feed(block.data() + h*hop*channels + k, hop, channels);
+                sink += ints[k].period;
+            }
+        }
+    }, 3) / hops / channels / 1000;
+
+    std::cout << "int16 detector, 44100 Hz, " << channels << " interleaved channels, us per feed\n"
+        << std::setprecision(1) << std::fixed
+        << "  Detector " << a << ", IntegerDetector " << b << ", " << a / b << "x"
+        << ", voicing agrees " << voiced << "/" << hops * channels
+        << ", pitch within 0.1% " << close << '\n';
+}
+
+void grid_operator(){
+
+    const unsigned frames = 2000;
+    const float p = 60.0f;
+
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> pitches(80.0f, 400.0f), values(0.0f, 1.0f);
+
+    vector<float> pitch(frames);
+    vector<vector<float>> energy(frames);
+    for(unsigned f=0; f<frames; f++){
+        pitch[f] = pitches(rng);
+        energy[f].resize(std::ceil(6000.0f / pitch[f]) + 1);
+        for(float &e : energy[f]) e = values(rng);
+    }
+
+    // the dense sums parse_to_csv used to do.
+    auto linear = [&](const vector<float> &in, float pitch, float *out){
+        for(int i=0, j=0; i<100; i++){
+            while((j+1)*pitch < (i+1)*p) j++;
+            float lp = j-1 >= 0 ? std::sqrt(in[j-1]) : 0.0f;
+            float rp = j < (int)in.size() ? std::sqrt(in[j]) : 0.0f;
+            out[i] = lp * ((j+1)*pitch - (i+1)*p)/pitch + rp * ((i+1)*p - j*pitch)/pitch;
+        }
+    };
+    auto sinc2 = [](float x) -> float {
+        if(std::abs(x) > 3) return 0.0f;
+        if(std::abs(x) < 1e-5) return 1.0f;
+        float y = std::sin(x*M_PI) / (x*M_PI);
+        return y*y;
+    };
+    auto spread = [&](const vector<float> &in, float pitch, float *out){
+        for(int i=0; i<100; i++){
+            out[i] = 0.0f;
+            for(int j=0; j<(int)in.size(); j++) out[i] += sinc2(((i+1)*p-(j+1)*pitch)/pitch) * in[j];
+        }
+    };
+
+    GridOperator amplitudes(GridOperator::linear), energies(GridOperator::sinc2);
+    vector<float> a(100), b(100);
+
+    float linearError = 0.0f, spreadError = 0.0f;
+    for(unsigned f=0; f<frames; f++){
+        linear(energy[f], pitch[f], a.data());
+        amplitudes.build(pitch[f], energy[f].size());
+        amplitudes.apply(energy[f].data(), b.data(), 1);
+        for(unsigned i=0; i<100; i++) linearError = std::max(linearError, std::abs(a[i] - b[i]));
+
+        spread(energy[f], pitch[f], a.data());
+        energies.build(pitch[f], energy[f].size());
+        energies.apply(energy[f].data(), b.data());
+        for(unsigned i=0; i<100; i++) spreadError = std::max(spreadError, std::abs(a[i] - b[i]) / a[i]);
+    }
+
+    auto per_frame = [&](auto &&run){
+        return time_ns([&]{
+            for(unsigned f=0; f<frames; f++){ run(f); sink += a[0]; }
+        }, 3) / frames;
+    };
+
+    double la = per_frame([&](unsigned f){ linear(energy[f], pitch[f], a.data()); });
+    double lb = per_frame([&](unsigned f){
+        amplitudes.build(pitch[f], energy[f].size());
+        amplitudes.apply(energy[f].data(), a.data(), 1);
+    });
+    double sa = per_frame([&](unsigned f){ spread(energy[f], pitch[f], a.data()); });
+    double sb = per_frame([&](unsigned f){
+        energies.build(pitch[f], energy[f].size());
+        energies.apply(energy[f].data(), a.data());
+    });
+
+    std::cout << "harmonics to the 60 Hz grid, pitch 80 - 400 Hz, ns per frame\n"
+        << std::setprecision(1) << std::fixed
+        << "  linear: dense " << la << ", GridOperator " << lb << ", " << la / lb << "x"
+        << std::scientific << ", max error " << linearError << '\n'
+        << std::fixed
+        << "  sinc2: dense " << sa << ", GridOperator " << sb << ", " << sa / sb << "x"
+        << std::scientific << ", max relative error " << spreadError << '\n';
+}
+
+// the rows through CsvWriter vs. the iostream formatting parse_to_csv had.
+// The bytes must be the same, returns 1 if they aren't or the write fails.
+unsigned csv_writer(){
+
+    const unsigned rows = 20000;
+
+    std::mt19937 rng(9);
+    std::uniform_real_distribution<float> values(0.0f, 1.0f);
+    vector<float> data(rows * 100);
+    for(float &v : data) v = values(rng);
+
+    std::string path = (std::filesystem::temp_directory_path() / "bench_csv_writer.csv").string();
+    double mb = 0.0;
+    bool closed = 1;
+
+    double a = time_ns([&]{
+        std::ofstream out(path);
+        out << std::setprecision(6) << std::fixed;
+        for(unsigned r=0; r<rows; r++){
+            const float *row = data.data() + r*100;
+            for(int j=0; j<99; j++) out << row[j] << ',';
+            out << row[99] << '\n';
+        }
+        out.flush();
+    }, 3);
+
+    std::string reference;
+    {
+        std::ifstream in(path);
+        reference.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    double b = time_ns([&]{
+        CsvWriter out;
+        out.open(path);
+        std::string text;
+        for(unsigned r=0; r<rows; r++) CsvWriter::format_row(text, data.data() + r*100, 100);
+        out.write(text);
+        closed &= out.close();
+        mb = out.bytes() / 1e6;
+    }, 3);
+
+    std::string written;
+    {
+        std::ifstream in(path);
+        written.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    std::filesystem::remove(path);
+
+    bool failed = !closed || written != reference;
+
+    std::cout << "csv of " << rows << " rows of 100 floats, ms\n"
+        << std::setprecision(1) << std::fixed
+        << "  iostream " << a / 1e6 << ", CsvWriter " << b / 1e6 << ", " << a / b << "x, "
+        << mb / (b / 1e9) << " MB/s, " << (written == reference ? "same bytes" : "DIFFERENT BYTES")
+        << (closed ? "" : ", write failed") << (failed ? "  FAILED" : "") << '\n';
+
+    return failed;
+}
+
+void classifier(){
+
+    // an mlp the shape of neural_network.py's, random weights.
+    const unsigned rows = 4096;
+
+    std::mt19937 rng(11);
+    std::normal_distribution<float> normal(0.0f, 0.3f);
+
+    Classifier c;
+    c.kind = Classifier::mlp;
+    c.inputs = 100;
+    c.labels = "aeiou";
+
+    vector<unsigned> widths = {100, 20, 20, 20, 20, 20, 5};
+    for(unsigned i=0; i+1<widths.size(); i++){
+        Classifier::Layer l;
+        l.in = widths[i];
+        l.out = widths[i+1];
+        l.activation = i+2 < widths.size() ? Classifier::relu : Classifier::identity;
+        l.weight.resize(l.in * l.out);
+        l.bias.resize(l.out);
+        for(float &w : l.weight) w = normal(rng);
+        for(float &b : l.bias) b = normal(rng);
+        c.layers.push_back(l);
+    }
+
+    vector<float> x(rows * 100);
+    for(float &v : x) v = std::abs(normal(rng));
+
+    // the same network one row at a time in double.
+    unsigned agree = 0;
+    for(unsigned r=0; r<rows; r++){
+        vector<double> a(x.begin() + r*100, x.begin() + (r+1)*100);
+        for(auto &l : c.layers){
+            vector<double> b(l.bias.begin(), l.bias.end());
+            for(unsigned k=0; k<l.in; k++) for(unsigned j=0; j<l.out; j++) b[j] += a[k] * l.weight[k*l.out + j];
+            if(l.activation == Classifier::relu) for(double &v : b) v = std::max(v, 0.0);
+            a = b;
+        }
+        char label;
+        c.classify(x.data() + r*100, 1, &label);
+        agree += label == c.labels[std::max_element(a.begin(), a.end()) - a.begin()];
+    }
+
+    std::string labels(rows, ' ');
+    double batch = 0.0, single = 0.0;
+
+    time_ns([&]{ batch = c.classify(x.data(), rows, &labels[0]); }, 3);
+    time_ns([&]{
+        single = 0.0;
+        for(unsigned r=0; r<rows; r++) single += c.classify(x.data() + r*100, 1, &labels[r]);
+        single /= rows;
+    }, 3);
+
+    std::cout << "mlp 100-20x5-5, us per frame\n"
+        << std::setprecision(3) << std::fixed
+        << "  batch of " << rows << " " << batch << ", one at a time " << single
+        << ", agrees with double " << agree << "/" << rows << '\n';
+}
+
+}   // namespace bench
+
+int main(){
+
+    bench::peak_search();
+    bench::detector_bank();
+    bench::coarse_search();
+    bench::realtime();
+    unsigned failed = bench::recovery();
+    bench::tracker();
+    bench::prescan();
+    failed += bench::segmented();
+    failed += bench::fixed_detector();
+    bench::integer_detector();
+    bench::grid_operator();
+    failed += bench::csv_writer();
+    bench::classifier();
+    failed += bench::feed_allocations();
+
+    return failed ? 1 : 0;
+}
@@ -15,11 +15,65 @@
 #include <chrono>
 #include <random>
 #include <filesystem>
+#include <map>
+#include <mutex>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <limits>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <charconv>
+#include <condition_variable>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 const long double PIL = 3.14159265358979323846264338327950288419716939937510l;
 const double  PI = PIL;
 const float PIF = PIL;
 
+/*****************************************************************************/
+// allocation counter /////////////////////////////////////////////////////////
+/*****************************************************************************/
+
+// with COUNT_ALLOCATIONS defined, every operator new of the program is counted
+// per thread, so tests can check that the hot paths don't allocate.
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <new>
+
+namespace debug {
+
+    thread_local uint64_t allocations = 0;
+
+    // not inlined, otherwise gcc warns about new-ed pointers going to free.
+    __attribute__((noinline)) void *allocate(std::size_t n){
+        allocations++;
+        if(void *p = std::malloc(n ? n : 1)) return p;
+        throw std::bad_alloc();
+    }
+
+    __attribute__((noinline)) void release(void *p){ std::free(p); }
+}
+
+void *operator new(std::size_t n){ return debug::allocate(n); }
+void *operator new[](std::size_t n){ return debug::allocate(n); }
+void operator delete(void *p) noexcept { debug::release(p); }
+void operator delete[](void *p) noexcept { debug::release(p); }
+void operator delete(void *p, std::size_t) noexcept { debug::release(p); }
+void operator delete[](void *p, std::size_t) noexcept { debug::release(p); }
+
+#endif  // COUNT_ALLOCATIONS
+
 /*****************************************************************************/
 // .wav file reader ///////////////////////////////////////////////////////////
 /*****************************************************************************/
@@ -58,6 +112,11 @@ inline float listen_int8_as_float(const char *r){
     return (float)x/(1<<7);
 }
 
+inline int16_t listen_int16(const char *r){
+    const uint8_t *c = (uint8_t*)r;
+    return (int16_t)(c[0] | c[1]<<8);
+}
+
 inline float listen_int16_as_float(const char *r){
     const uint8_t *c = (uint8_t*)r;
     int16_t x = (int16_t)c[0] | c[1]<<8;
@@ -78,9 +137,10 @@ inline float listen_int32_as_float(const char *r){
 
 inline float listen_float32(const char *r){
     const uint8_t *c = (uint8_t*)r;
-    const int32_t x = (int32_t)c[0] | c[1]<<8 | c[2]<<16 | c[3]<<24;
-    const char *t = (char*)&x;
-    return *((float*)t);
+    const uint32_t x = (uint32_t)c[0] | c[1]<<8 | c[2]<<16 | (uint32_t)c[3]<<24;
+    float f;
+    std::memcpy(&f, &x, 4);
+    return f;
 }
 
 
@@ -296,6 +356,13 @@ protected:
     std::ifstream wavFile;
     uint32_t dataBegin;
 
+    // raw bytes of the latest read_move, reused between reads.
+    std::vector<char> bytes;
+
+    // the samples of an int16 read_move from another format, before the
+    // conversion. Reused between reads too.
+    std::vector<float> converted;
+
     uint16_t read_uint16();
     uint32_t read_uint32();
 
@@ -350,6 +417,12 @@ public:
     uint32_t read_file(std::vector<float> &waves);
     uint32_t read_file(float *waves);
     std::vector<float> read_file();
+
+    // the same as 16 bit integers. 16 bit files are copied as is, the other
+    // formats go through float and are clipped like in say_float_as_int16.
+    uint32_t read_move(std::vector<int16_t> &waves, uint32_t amount);
+    uint32_t read_move(int16_t *waves, uint32_t amount);
+    uint32_t read_file(std::vector<int16_t> &waves);
         
 };
 
@@ -750,7 +823,8 @@ uint32_t iwstream::read_move(float *waves, uint32_t amount){
 
     int64_t buffz = readAmount*sampleSize;
 
-    char *buff = new char[buffz];
+    if((int64_t)bytes.size() < buffz) bytes.resize(buffz);
+    char *buff = bytes.data();
     
     wavFile.read(buff, buffz);
 
@@ -793,11 +867,8 @@ uint32_t iwstream::read_move(float *waves, uint32_t amount){
 
     if(wavFile.eof() || (uint32_t)wavFile.tellg()-dataBegin >= dataSize){
         if(logging) add_log("end of file reached");
-        return readAmount;
     }
 
-    delete[] buff;
-
     return readAmount;
 }
 
@@ -878,6 +949,76 @@ std::vector<float> iwstream::read_file(){
     read_file(waves);
     return waves;
 }
+
+uint32_t iwstream::read_move(std::vector<int16_t> &waves, uint32_t amount){
+
+    if(!wavFile.good()){
+        if(logging) add_log("error reading file");
+        return 0;
+    }
+
+    int64_t bsize = waves.size();
+    waves.resize(bsize+amount, 0);
+
+    return read_move(waves.data()+bsize, amount);
+}
+
+uint32_t iwstream::read_move(int16_t *waves, uint32_t amount){
+
+    if(datatype != wave_dialog::INT16_ID){
+
+        if(converted.size() < amount) converted.resize(amount);
+        const float *w = converted.data();
+        uint32_t readAmount = read_move(converted.data(), amount);
+
+        for(uint32_t i=0; i<readAmount; i++){
+            waves[i] = (int16_t)std::min((float)((1<<15)-1),
+                    std::max(-(float)(1<<15), w[i]*(1<<15)));
+        }
+        return readAmount;
+    }
+
+    if(!wavFile.good()){
+        if(logging) add_log("error reading file");
+        return 0;
+    }
+
+    uint32_t readAmount = amount;
+
+    int64_t probeSize = (int64_t)amount*sampleSize+wavFile.tellg()-dataBegin;
+
+    if(probeSize > (int64_t)dataSize){
+        readAmount = amount - (probeSize-dataSize)/sampleSize;
+        if(logging){
+            add_log(
+                "could only read "+std::to_string(readAmount)
+                +" frames as end end of file was reached.");
+        }
+    }
+
+    int64_t buffz = (int64_t)readAmount*sampleSize;
+
+    if((int64_t)bytes.size() < buffz) bytes.resize(buffz);
+    char *buff = bytes.data();
+
+    wavFile.read(buff, buffz);
+
+    for(uint32_t i=0; i<readAmount; i++){
+        waves[i] = wave_dialog::listen_int16(buff+i*sampleSize);
+    }
+
+    if(!wavFile){
+        if(logging) add_log("error reading file");
+        return 0;
+    }
+
+    return readAmount;
+}
+
+uint32_t iwstream::read_file(std::vector<int16_t> &waves){
+    wavFile.seekg(dataBegin);
+    return read_move(waves, dataSize/sampleSize);
+}
 /*****************************************************************************/
 // fft ////////////////////////////////////////////////////////////////////////
 /*****************************************************************************/
@@ -890,6 +1031,11 @@ namespace math {
 void in_place_fft(std::complex<float> *v, unsigned n, bool inv = 0);
 void in_place_fft(std::vector<std::complex<float> > &v, bool inv = 0);
 
+// fft of lanes vectors at once. element i of vector k is at [i*lanes + k], and
+// the real and imaginary parts are kept in separate arrays, so the butterflies
+// run across the lanes in simd. n must be a power of 2.
+void batched_fft(float *re, float *im, unsigned n, unsigned lanes, bool inv = 0);
+
 std::vector<std::complex<float> > fft(const float *v, unsigned n);
 std::vector<std::complex<float> > fft(const std::vector<float> &v);
 
@@ -906,9 +1052,50 @@ std::vector<std::complex<float> > convolution(
         unsigned size = 0);
 
 std::vector<float> correlation(std::vector<float> a, std::vector<float> b, unsigned size = 0);
+std::vector<float> correlation(const float *a, unsigned n, const float *b, unsigned m,
+        unsigned size = 0);
 
 // implementation that utilizes fft's bandwidth of 2 vectors. The second vector is optional.
 std::array<std::vector<float>, 2> autocorrelation(std::vector<float> a, std::vector<float> b = {});
+std::array<std::vector<float>, 2> autocorrelation(
+        const float *a, unsigned n, const float *b = nullptr, unsigned m = 0);
+
+// versions of the above that write into preallocated memory and don't allocate.
+// work must hold correlation_size(n, m) or autocorrelation_size(n, m) complex numbers.
+// correlation writes the first count values, count <= correlation_size(n, m).
+
+constexpr unsigned correlation_size(unsigned n, unsigned m){
+    unsigned z = 1;
+    while(z < n + m - 1) z *= 2;
+    return z;
+}
+
+void correlation(const float *a, unsigned n, const float *b, unsigned m,
+        float *r, unsigned count, std::complex<float> *work);
+
+constexpr unsigned autocorrelation_size(unsigned n, unsigned m = 0){
+    unsigned z = 1;
+    while(z < std::max(n, m)) z *= 2;
+    return 2*z;
+}
+
+void autocorrelation(const float *a, unsigned n, const float *b, unsigned m,
+        float *ra, float *rb, std::complex<float> *work);
+
+// the same with the transform size N fixed at compile time, so the loop
+// bounds of the ffts are constants. N must be correlation_size(n, m) or
+// autocorrelation_size(n, m). The results are bit for bit the ones above.
+
+template<unsigned N>
+void fixed_fft(std::complex<float> *v, bool inv = 0);
+
+template<unsigned N>
+void fixed_correlation(const float *a, unsigned n, const float *b, unsigned m,
+        float *r, unsigned count, std::complex<float> *work);
+
+template<unsigned N>
+void fixed_autocorrelation(const float *a, unsigned n, const float *b, unsigned m,
+        float *ra, float *rb, std::complex<float> *work);
 
 // these are ~6 times slower on average than radix 2, but support all sizes.
 
@@ -973,6 +1160,9 @@ void in_place_fft(complex<float> *v, unsigned n, bool inv){
     unsigned bits = 0;
     while(1u<<bits < n) bits++;
 
+    // larger sizes need a larger table, see FFTPrecalc. Without asserts
+    // the input is left as is rather than read past the table.
+    assert(bits <= fftPrecalc.B);
     if(bits > fftPrecalc.B) return;
     if(1u<<bits != n){
         vector<complex<float> > w(n);
@@ -1009,6 +1199,66 @@ void in_place_fft(vector<complex<float> > &v, bool inv){
     in_place_fft(v.data(), v.size(), inv);
 }
 
+// one butterfly for all the lanes.
+static void batched_butterfly(
+        float *__restrict ar, float *__restrict ai,
+        float *__restrict br, float *__restrict bi,
+        float wr, float wi, unsigned lanes){
+
+    for(unsigned k=0; k<lanes; k++){
+        float tr = wr*br[k] - wi*bi[k];
+        float ti = wr*bi[k] + wi*br[k];
+        br[k] = ar[k] - tr;
+        bi[k] = ai[k] - ti;
+        ar[k] = ar[k] + tr;
+        ai[k] = ai[k] + ti;
+    }
+}
+
+void batched_fft(float *re, float *im, unsigned n, unsigned lanes, bool inv){
+
+    unsigned bits = 0;
+    while(1u<<bits < n) bits++;
+
+    assert(1u<<bits == n);
+    assert(bits <= fftPrecalc.B);
+    if(bits > fftPrecalc.B) return;
+
+    unsigned shift = fftPrecalc.B-bits;
+
+    for(unsigned i=0; i<n; i++){
+        unsigned j = fftPrecalc.invbit[i]>>shift;
+        if(i < j){
+            std::swap_ranges(re + i*lanes, re + (i+1)*lanes, re + j*lanes);
+            std::swap_ranges(im + i*lanes, im + (i+1)*lanes, im + j*lanes);
+        }
+    }
+
+    for(unsigned r=0; r<bits; r++){
+        unsigned rd = 1u<<r;
+        for(unsigned i=0; i<n; i+=2*rd){
+            for(unsigned j=i; j<i+rd; j++){
+                complex<float> w = fftPrecalc.w[r][j-i];
+                batched_butterfly(
+                        re + j*lanes, im + j*lanes,
+                        re + (j+rd)*lanes, im + (j+rd)*lanes,
+                        w.real(), w.imag(), lanes);
+            }
+        }
+    }
+
+    if(inv){
+        for(unsigned i=1; 2*i<n; i++){
+            std::swap_ranges(re + i*lanes, re + (i+1)*lanes, re + (n-i)*lanes);
+            std::swap_ranges(im + i*lanes, im + (i+1)*lanes, im + (n-i)*lanes);
+        }
+        for(unsigned i=0; i<n*lanes; i++){
+            re[i] /= n;
+            im[i] /= n;
+        }
+    }
+}
+
 vector<complex<float> > fft(const float *v, unsigned n){
     vector<complex<float> > f(n);
     for(unsigned i=0; i<n; i++) f[i] = v[i];
@@ -1045,6 +1295,26 @@ vector<complex<float> > fft(complex<float> *v, unsigned n, bool inv){
     return f;
 }
 
+// the spectrum of the convolution of the real and the imaginary part of c.
+static void convolution_spectrum(complex<float> *c, unsigned cz){
+    for(unsigned i=0; 2*i<=cz; i++){
+        unsigned j = i == 0 ? 0 : cz-i;
+        c[i] = -(c[i]-conj(c[j]))*(c[i]+conj(c[j]))*complex<float>(0, 0.25f);
+        c[j] = conj(c[i]);
+    }
+}
+
+// c holds the two real vectors to convolve in its real and imaginary parts.
+// the first n values of the result are written to r.
+static void packed_convolution(complex<float> *c, unsigned cz, float *r, unsigned n){
+
+    in_place_fft(c, cz);
+    convolution_spectrum(c, cz);
+    in_place_fft(c, cz, 1);
+
+    for(unsigned i=0; i<n; i++) r[i] = c[i].real();
+}
+
 vector<float> convolution(vector<float> &a, vector<float> &b, unsigned size){
     
     unsigned za = a.size(), zb = b.size();
@@ -1062,18 +1332,8 @@ vector<float> convolution(vector<float> &a, vector<float> &b, unsigned size){
         if(i < zb) c[i] = {c[i].real(), b[i]};
     }
 
-    in_place_fft(c);
-
-    for(unsigned i=0; 2*i<=cz; i++){
-        unsigned j = i == 0 ? 0 : cz-i;
-        c[i] = -(c[i]-conj(c[j]))*(c[i]+conj(c[j]))*complex<float>(0, 0.25f);
-        c[j] = conj(c[i]);
-    }
-
-    in_place_fft(c, 1);
-
-    vector<float> r(n, 0);
-    for(unsigned i=0; i<n; i++) r[i] = c[i].real();
+    vector<float> r(n);
+    packed_convolution(c.data(), cz, r.data(), n);
     
     return r;
 }
@@ -1120,17 +1380,62 @@ vector<float> correlation(vector<float> a, vector<float> b, unsigned size){
     return convolution(a, b, z);
 }
 
+vector<float> correlation(const float *a, unsigned n, const float *b, unsigned m, unsigned size){
+
+    unsigned k = size;
+    if(!k) k = n + m - 1;
+
+    unsigned z = 1;
+    while(z < k) z *= 2;
+
+    // same as above, but b is reversed while packing it next to a.
+
+    vector<complex<float> > c(z, {0, 0});
+    for(unsigned i=0; i<n && i<z; i++) c[i] = {a[i], 0.0f};
+    if(m) c[0] = {c[0].real(), b[0]};
+    for(unsigned i=1; i<m && i<z; i++) c[z-i] = {c[z-i].real(), b[i]};
+
+    vector<float> r(z);
+    packed_convolution(c.data(), z, r.data(), z);
+
+    return r;
+}
+
+// a in the real part, b reversed in the imaginary part.
+static void pack_correlation(const float *a, unsigned n, const float *b, unsigned m,
+        complex<float> *c, unsigned z){
+    std::fill(c, c + z, complex<float>(0.0f, 0.0f));
+    for(unsigned i=0; i<n; i++) c[i] = {a[i], 0.0f};
+    if(m) c[0] = {c[0].real(), b[0]};
+    for(unsigned i=1; i<m; i++) c[z-i] = {c[z-i].real(), b[i]};
+}
+
+void correlation(const float *a, unsigned n, const float *b, unsigned m,
+        float *r, unsigned count, complex<float> *c){
+
+    unsigned z = correlation_size(n, m);
+
+    pack_correlation(a, n, b, m, c, z);
+    packed_convolution(c, z, r, count);
+}
+
 std::array<vector<float>, 2> autocorrelation(vector<float> a, vector<float> b){
+    return autocorrelation(a.data(), a.size(), b.data(), b.size());
+}
+
+std::array<vector<float>, 2> autocorrelation(const float *a, unsigned n, const float *b, unsigned m){
     
-    unsigned n = a.size(), m = b.size(), z = 1;
-    while(z < std::max(n, m)) z *= 2;
+    vector<complex<float> > c(autocorrelation_size(n, m));
+    std::array<vector<float>, 2> r = {vector<float>(n), vector<float>(m)};
 
-    vector<complex<float> > c(2*z, 0.0f);
-    for(unsigned i=0; i<n; i++) c[i] = {a[i], 0.0f};
-    for(unsigned i=0; i<m; i++) c[i] = {c[i].real(), b[i]};
+    autocorrelation(a, n, b, m, r[0].data(), r[1].data(), c.data());
 
-    in_place_fft(c);
+    return r;
+}
 
+// the spectra of the autocorrelations of the real and the imaginary part
+// of the transform c of size 2*z.
+static void autocorrelation_spectrum(complex<float> *c, unsigned z){
     for(unsigned i=0; i<=z; i++){
         
         unsigned j = i == 0 ? 0 : 2*z-i;
@@ -1147,13 +1452,98 @@ std::array<vector<float>, 2> autocorrelation(vector<float> a, vector<float> b){
         c[i] = c[j] = x*conj(x) - y*complex<float>(-y.real(), y.imag()) * complex<float>(0, 1);
         */
     }
+}
+
+void autocorrelation(const float *a, unsigned n, const float *b, unsigned m,
+        float *ra, float *rb, complex<float> *c){
     
-    in_place_fft(c, 1);
+    unsigned z = autocorrelation_size(n, m) / 2;
+
+    std::fill(c, c + 2*z, complex<float>(0.0f, 0.0f));
+    for(unsigned i=0; i<n; i++) c[i] = {a[i], 0.0f};
+    for(unsigned i=0; i<m; i++) c[i] = {c[i].real(), b[i]};
+
+    in_place_fft(c, 2*z);
+    autocorrelation_spectrum(c, z);
+    in_place_fft(c, 2*z, 1);
+
+    for(unsigned i=0; i<n; i++) ra[i] = c[i].real();
+    for(unsigned i=0; i<m; i++) rb[i] = c[i].imag();
+}
+
+template<unsigned N>
+void fixed_fft(complex<float> *v, bool inv){
+
+    static_assert(N >= 2 && (N & (N-1)) == 0, "fixed_fft size must be a power of 2");
+
+    constexpr unsigned bits = __builtin_ctz(N);
+    assert(bits <= fftPrecalc.B);
+    if(bits > fftPrecalc.B) return;
+
+    const unsigned shift = fftPrecalc.B-bits;
+
+    for(unsigned i=0; i<N; i++){
+        if(i < fftPrecalc.invbit[i]>>shift) std::swap(v[i], v[fftPrecalc.invbit[i]>>shift]);
+    }
+
+    // the first round only multiplies by w = 1.
+    for(unsigned i=0; i<N; i+=2){
+        complex<float> tmp = v[i+1];
+        v[i+1] = v[i]-tmp;
+        v[i] = v[i]+tmp;
+    }
+
+    for(unsigned r=1; r<bits; r++){
+        const unsigned rd = 1u<<r;
+        const complex<float> *w = fftPrecalc.w[r].data();
+        for(unsigned i=0; i<N; i+=2*rd){
+            for(unsigned j=0; j<rd; j++){
+                complex<float> tmp = w[j]*v[i+j+rd];
+                v[i+j+rd] = v[i+j]-tmp;
+                v[i+j] = v[i+j]+tmp;
+            }
+        }
+    }
+
+    if(inv){
+        std::reverse(v+1, v+N);
+        // exact, N is a power of 2.
+        const float scale = 1.0f / N;
+        for(unsigned i=0; i<N; i++) v[i] *= scale;
+    }
+}
+
+template<unsigned N>
+void fixed_correlation(const float *a, unsigned n, const float *b, unsigned m,
+        float *r, unsigned count, complex<float> *c){
+
+    assert(correlation_size(n, m) == N);
+
+    pack_correlation(a, n, b, m, c, N);
+
+    fixed_fft<N>(c);
+    convolution_spectrum(c, N);
+    fixed_fft<N>(c, 1);
+
+    for(unsigned i=0; i<count; i++) r[i] = c[i].real();
+}
+
+template<unsigned N>
+void fixed_autocorrelation(const float *a, unsigned n, const float *b, unsigned m,
+        float *ra, float *rb, complex<float> *c){
+
+    assert(autocorrelation_size(n, m) == N);
+
+    std::fill(c, c + N, complex<float>(0.0f, 0.0f));
+    for(unsigned i=0; i<n; i++) c[i] = {a[i], 0.0f};
+    for(unsigned i=0; i<m; i++) c[i] = {c[i].real(), b[i]};
 
-    for(unsigned i=0; i<n; i++) a[i] = c[i].real();
-    for(unsigned i=0; i<m; i++) b[i] = c[i].imag();
+    fixed_fft<N>(c);
+    autocorrelation_spectrum(c, N/2);
+    fixed_fft<N>(c, 1);
 
-    return {a, b};
+    for(unsigned i=0; i<n; i++) ra[i] = c[i].real();
+    for(unsigned i=0; i<m; i++) rb[i] = c[i].imag();
 }
 
 vector<complex<float> > bluestein(vector<complex<float> > v, bool inv){
@@ -1202,48 +1592,60 @@ vector<float> inverse_bluestein(vector<complex<float> > &v){
 
 
 /*****************************************************************************/
-// ft /////////////////////////////////////////////////////////////////////////
+// window /////////////////////////////////////////////////////////////////////
 /*****************************************************************************/
 
 namespace math {
 
-// Laplace transform... I guess
-std::complex<float> lt(const float *waves, unsigned size, float frequency);
-std::complex<float> lt(const std::vector<float> &waves, float frequency);
+// all windows are periodic, i.e. w[0] is the minimum and w[size/2] the peak,
+// so that a window over k periods keeps harmonics on the bins k, 2k, ...
 
-// Poor man's DFT. can't handle vectors larger than 2^15
-std::vector<std::complex<float> > ft(
-        const float *waves, unsigned size, unsigned n, bool haszero = 0);
-std::vector<std::complex<float> > ft(
-        const std::vector<float> &waves, unsigned n, bool haszero = 0);
+enum class Window {
+    hann,
+    hamming,
+    blackman_harris,    // 4-term, -92 dB sidelobes
+    kaiser,             // beta = WindowTable::kaiserBeta
+    gaussian            // sigma = WindowTable::gaussianSigma of the half width
+};
 
-// multiplies the waves by a cosine window (convolution kernel [0.25, 0.5, 0.25] on frequency side)
-// and then takes dft of every other frequency
-std::vector<std::complex<float> > cos_window_ft(
-        float *waves, unsigned size, unsigned n, bool haszero = 0);
-std::vector<std::complex<float> > cos_window_ft(
-        std::vector<float> waves, unsigned n, bool haszero = 0);
+struct WindowTable {
 
-std::vector<std::complex<float> > precise_ft(
-        const std::vector<float> &waves, unsigned n, bool haszero = 0, float speed = 1.0f);
+    static constexpr float kaiserBeta = 8.6f;
+    static constexpr float gaussianSigma = 0.4f;
 
-std::vector<float> ift(
-        const std::vector<std::complex<float> > &frequencies,
-        unsigned size, bool haszero = 0);
+    // storage is 32 byte aligned and padded with zeros to a multiple of 8 floats.
+    float *data = nullptr;
+    unsigned size = 0;
+    float sum = 0.0f;   // coherent gain * size
 
-std::vector<float> sized_ift(
-        const std::vector<std::complex<float> > &frequencies,
-        unsigned period, unsigned size);
+    WindowTable(Window type, unsigned size);
+    ~WindowTable();
 
-struct FTPrecalc {
-    FTPrecalc();
-    static const unsigned N = 1<<18;
-    static constexpr double dN = N;
-    std::complex<float> exp[N+1];
+    WindowTable(const WindowTable&) = delete;
+    WindowTable &operator=(const WindowTable&) = delete;
 };
 
-extern FTPrecalc ftPrecalc;
-std::complex<float> cexp(double radians);
+// precomputed windows are cached by (type, size) and live until the program exits.
+// safe to call from multiple threads, only the first call per thread and table locks.
+const WindowTable &window(Window type, unsigned size);
+
+// dst[i] = src[i] * w.data[i] for i = 0..w.size-1, the window applied
+// while the samples are copied into the transform input.
+void window_copy(const float *src, const WindowTable &w, float *dst);
+
+// dst[i] += scale * src[i] and dst[i] += scale * src[-i] for i = 0..n-1.
+void multiply_add(float *dst, const float *src, float scale, unsigned n);
+void multiply_add_reverse(float *dst, const float *src, float scale, unsigned n);
+
+// sum((a[i] - b[i])^2) for i = 0..n-1. the sum is split in 8 parts so it vectorizes.
+float squared_distance(const float *a, const float *b, unsigned n);
+
+// sum of a[i] and of a[i]^2 for i = 0..n-1, split the same way.
+void sum_and_squares(const float *a, unsigned n, float &sum, float &squares);
+
+// sum(a[i] * b[i]) for i = 0..n-1 on 16 bit samples, exact. With avx2 the
+// products are summed in pairs by vpmaddwd, 16 per instruction.
+int64_t dot(const int16_t *a, const int16_t *b, unsigned n);
 
 }   // namespace math
 
@@ -1251,22 +1653,258 @@ std::complex<float> cexp(double radians);
 
 namespace math {
 
-using std::vector;
-using std::complex;
+WindowTable::WindowTable(Window type, unsigned size_) : size(size_) {
 
-complex<float> lt(const float *waves, unsigned size, float frequency){
-    
-    complex<float> sinusoid = {0, 0};
+    unsigned padded = (size + 7) / 8 * 8;
+    data = (float*)std::aligned_alloc(32, std::max(padded, 8u) * sizeof(float));
+    for(unsigned i=size; i<padded; i++) data[i] = 0.0f;
+
+    // Kaiser window needs the modified bessel function of the first kind.
+    auto bessel0 = [](double x) -> double {
+        double sum = 1.0, term = 1.0;
+        for(unsigned k=1; k<64 && term > 1e-12 * sum; k++){
+            term *= (x / (2*k)) * (x / (2*k));
+            sum += term;
+        }
+        return sum;
+    };
 
     for(unsigned i=0; i<size; i++){
-        sinusoid += waves[i]*std::polar(1.0f, -2 * PIF / size * i * (float)frequency);
-    }
 
-    return std::conj(sinusoid);
+        double t = 2.0 * PI * i / size;
+        double x = 2.0 * i / size - 1.0;    // -1 .. 1
+        double w = 1.0;
+
+        switch(type){
+            case Window::hann:
+                w = 0.5 - 0.5 * std::cos(t);
+                break;
+            case Window::hamming:
+                w = 0.54 - 0.46 * std::cos(t);
+                break;
+            case Window::blackman_harris:
+                w = 0.35875 - 0.48829 * std::cos(t) + 0.14128 * std::cos(2*t)
+                    - 0.01168 * std::cos(3*t);
+                break;
+            case Window::kaiser:
+                w = bessel0(kaiserBeta * std::sqrt(std::max(0.0, 1.0 - x*x))) / bessel0(kaiserBeta);
+                break;
+            case Window::gaussian:
+                w = std::exp(-0.5 * (x / gaussianSigma) * (x / gaussianSigma));
+                break;
+        }
+
+        data[i] = w;
+        sum += w;
+    }
 }
 
-complex<float> lt(const vector<float> &waves, float frequency){
-    return lt(waves.data(), waves.size(), frequency);
+WindowTable::~WindowTable(){
+    std::free(data);
+}
+
+const WindowTable &window(Window type, unsigned size){
+
+    // tables are never freed, so each thread keeps its own index of the ones
+    // it has seen and only takes the lock the first time it asks for one.
+    thread_local std::map<std::pair<Window, unsigned>, const WindowTable*> seen;
+
+    auto &known = seen[{type, size}];
+    if(known) return *known;
+
+    static std::map<std::pair<Window, unsigned>, std::unique_ptr<WindowTable> > cache;
+    static std::mutex lock;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto &table = cache[{type, size}];
+    if(!table) table = std::make_unique<WindowTable>(type, size);
+
+    known = table.get();
+    return *table;
+}
+
+void window_copy(const float *__restrict src, const WindowTable &w, float *__restrict dst){
+    const float *__restrict t = w.data;
+    for(unsigned i=0; i<w.size; i++) dst[i] = src[i] * t[i];
+}
+
+void multiply_add(float *__restrict dst, const float *__restrict src, float scale, unsigned n){
+    for(unsigned i=0; i<n; i++) dst[i] += scale * src[i];
+}
+
+void multiply_add_reverse(float *__restrict dst, const float *__restrict src, float scale,
+        unsigned n){
+    for(unsigned i=0; i<n; i++) dst[i] += scale * src[-(int)i];
+}
+
+float squared_distance(const float *__restrict a, const float *__restrict b, unsigned n){
+
+    float part[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    unsigned i = 0;
+    for(; i+8<=n; i+=8){
+        for(unsigned j=0; j<8; j++){
+            float d = a[i+j] - b[i+j];
+            part[j] += d * d;
+        }
+    }
+
+    float sum = 0.0f;
+    for(; i<n; i++) sum += (a[i] - b[i]) * (a[i] - b[i]);
+    for(unsigned j=0; j<8; j++) sum += part[j];
+
+    return sum;
+}
+
+int64_t dot(const int16_t *a, const int16_t *b, unsigned n){
+
+    int64_t sum = 0;
+    unsigned i = 0;
+
+#ifdef __AVX2__
+    // a pair sum is in (-2^31, 2^31], so pair sum - 2^16 fits in int32 (the
+    // madd result wraps around only for 2^31, and the subtraction undoes it).
+    // Those are split into the low 16 bits and the rest, which can be summed
+    // 2^15 times each before int32 overflows. The 2^16s are added back at the end.
+    const __m256i low = _mm256_set1_epi32(0xffff), offset = _mm256_set1_epi32(1 << 16);
+
+    while(i+16 <= n){
+
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+        unsigned end = i + 16 * std::min((n - i) / 16, 1u << 15);
+
+        sum += (int64_t)(end - i) / 2 * 65536;
+
+        for(; i<end; i+=16){
+            __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+            __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+            __m256i p = _mm256_sub_epi32(_mm256_madd_epi16(x, y), offset);
+            lo = _mm256_add_epi32(lo, _mm256_and_si256(p, low));
+            hi = _mm256_add_epi32(hi, _mm256_srai_epi32(p, 16));
+        }
+
+        int32_t l[8], h[8];
+        _mm256_storeu_si256((__m256i*)l, lo);
+        _mm256_storeu_si256((__m256i*)h, hi);
+        for(unsigned j=0; j<8; j++) sum += (int64_t)h[j] * 65536 + (uint32_t)l[j];
+    }
+#endif
+
+    for(; i<n; i++) sum += (int32_t)a[i] * b[i];
+
+    return sum;
+}
+
+void sum_and_squares(const float *__restrict a, unsigned n, float &sum, float &squares){
+
+    float part[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    float partSquares[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    unsigned i = 0;
+    for(; i+8<=n; i+=8){
+        for(unsigned j=0; j<8; j++){
+            part[j] += a[i+j];
+            partSquares[j] += a[i+j] * a[i+j];
+        }
+    }
+
+    sum = squares = 0.0f;
+    for(; i<n; i++){
+        sum += a[i];
+        squares += a[i] * a[i];
+    }
+    for(unsigned j=0; j<8; j++){
+        sum += part[j];
+        squares += partSquares[j];
+    }
+}
+
+}   // namespace math
+
+
+/*****************************************************************************/
+// ft /////////////////////////////////////////////////////////////////////////
+/*****************************************************************************/
+
+namespace math {
+
+// Laplace transform... I guess
+std::complex<float> lt(const float *waves, unsigned size, float frequency);
+std::complex<float> lt(const std::vector<float> &waves, float frequency);
+
+// Poor man's DFT. can't handle vectors larger than 2^15
+std::vector<std::complex<float> > ft(
+        const float *waves, unsigned size, unsigned n, bool haszero = 0);
+std::vector<std::complex<float> > ft(
+        const std::vector<float> &waves, unsigned n, bool haszero = 0);
+
+// windows the waves (by default a cosine window, convolution kernel [0.25, 0.5, 0.25]
+// on frequency side) and then takes dft of every other frequency.
+// the window comes from the cache and is applied on the fly, waves is left untouched.
+std::vector<std::complex<float> > cos_window_ft(
+        const float *waves, unsigned size, unsigned n, bool haszero = 0,
+        Window type = Window::hann);
+std::vector<std::complex<float> > cos_window_ft(
+        const std::vector<float> &waves, unsigned n, bool haszero = 0,
+        Window type = Window::hann);
+
+// the buffers of cos_window_ft. Kept between the calls, it allocates only
+// when they grow, and exp is only recomputed when the size changes.
+struct WindowedFT {
+    std::vector<std::complex<float> > exp, frequencies;
+    std::vector<float> windowed;
+    unsigned size = 0;
+};
+
+// the same into work.frequencies.
+const std::vector<std::complex<float> > &cos_window_ft(WindowedFT &work,
+        const float *waves, unsigned size, unsigned n, bool haszero = 0,
+        Window type = Window::hann);
+
+std::vector<std::complex<float> > precise_ft(
+        const std::vector<float> &waves, unsigned n, bool haszero = 0, float speed = 1.0f);
+
+std::vector<float> ift(
+        const std::vector<std::complex<float> > &frequencies,
+        unsigned size, bool haszero = 0);
+
+std::vector<float> sized_ift(
+        const std::vector<std::complex<float> > &frequencies,
+        unsigned period, unsigned size);
+
+struct FTPrecalc {
+    FTPrecalc();
+    static const unsigned N = 1<<18;
+    static constexpr double dN = N;
+    std::complex<float> exp[N+1];
+};
+
+extern FTPrecalc ftPrecalc;
+std::complex<float> cexp(double radians);
+
+}   // namespace math
+
+
+
+namespace math {
+
+using std::vector;
+using std::complex;
+
+complex<float> lt(const float *waves, unsigned size, float frequency){
+    
+    complex<float> sinusoid = {0, 0};
+
+    for(unsigned i=0; i<size; i++){
+        sinusoid += waves[i]*std::polar(1.0f, -2 * PIF / size * i * (float)frequency);
+    }
+
+    return std::conj(sinusoid);
+}
+
+complex<float> lt(const vector<float> &waves, float frequency){
+    return lt(waves.data(), waves.size(), frequency);
 }
 
 vector<complex<float> > ft(const float *waves, unsigned size, unsigned n, bool haszero){
@@ -1293,30 +1931,50 @@ vector<complex<float> > ft(const vector<float> &waves, unsigned n, bool haszero)
     return ft(waves.data(), waves.size(), n, haszero);
 }
 
-vector<complex<float> > cos_window_ft(float *waves, unsigned size, unsigned n, bool haszero){
-    
-    vector<complex<float> > frequencies(n, 0.0f);
-    
-    vector<complex<float> > exp(size);
-    for(unsigned i=0; i<size; i++) exp[i] = cexp((double)-i / size);
+vector<complex<float> > cos_window_ft(const float *waves, unsigned size, unsigned n,
+        bool haszero, Window type){
+    WindowedFT work;
+    cos_window_ft(work, waves, size, n, haszero, type);
+    return std::move(work.frequencies);
+}
+
+const vector<complex<float> > &cos_window_ft(WindowedFT &work,
+        const float *waves, unsigned size, unsigned n, bool haszero, Window type){
+
+    vector<complex<float> > &frequencies = work.frequencies;
+    frequencies.assign(n, 0.0f);
+    if(size == 0) return frequencies;
 
-    for(unsigned i=0; i<size; i++) waves[i] *= 0.5f - 0.5f * exp[i].real();
+    if(work.size != size){
+        work.exp.resize(size);
+        for(unsigned i=0; i<size; i++) work.exp[i] = cexp(-(double)i / size);
+        work.size = size;
+    }
+
+    const WindowTable &w = window(type, size);
 
+    if(work.windowed.size() < size) work.windowed.resize(size);
+    window_copy(waves, w, work.windowed.data());
+
+    const complex<float> *exp = work.exp.data();
+    const float *x = work.windowed.data();
     unsigned offset = !haszero;
 
     for(unsigned i=0; i<size; i++){
         for(unsigned j=0; j<n; j++){
-            frequencies[j] += exp[i * (2*(j+offset)) % size] * waves[i];
+            frequencies[j] += exp[i * (2*(j+offset)) % size] * x[i];
         }
     }
 
-    for(auto &i : frequencies) i = 4.0f * i / (float)size;
+    // divide by the coherent gain. for hann this is the familiar 4 / size.
+    for(auto &i : frequencies) i = 2.0f * i / w.sum;
 
     return frequencies;
 }
 
-vector<complex<float> > cos_window_ft(vector<float> waves, unsigned n, bool haszero){
-    return cos_window_ft(waves.data(), waves.size(), n, haszero);
+vector<complex<float> > cos_window_ft(const vector<float> &waves, unsigned n,
+        bool haszero, Window type){
+    return cos_window_ft(waves.data(), waves.size(), n, haszero, type);
 }
 
 vector<complex<float> > precise_ft(const vector<float> &waves,
@@ -1404,6 +2062,83 @@ complex<float> cexp(double radians){
 
 namespace change {
 
+// read-only view to contiguous samples.
+struct View {
+
+    const float *ptr = nullptr;
+    unsigned n = 0;
+
+    const float *data() const { return ptr; }
+    unsigned size() const { return n; }
+    bool empty() const { return n == 0; }
+
+    const float *begin() const { return ptr; }
+    const float *end() const { return ptr + n; }
+    float operator[](unsigned i) const { return ptr[i]; }
+};
+
+// ring buffer that writes every sample twice, capacity samples apart.
+// this way the latest capacity samples are always one linear block in memory.
+class Ring {
+
+public:
+
+    Ring(unsigned capacity = 0);
+
+    // also clears the contents.
+    void resize(unsigned capacity);
+
+    // fill with zeros.
+    void clear();
+
+    // append samples, the oldest ones are dropped.
+    void push(const float *data, unsigned n);
+
+    // data()[0] is the oldest and data()[size()-1] the latest sample.
+    const float *data() const { return storage.data() + head; }
+    unsigned size() const { return capacity; }
+    float operator[](unsigned i) const { return data()[i]; }
+
+private:
+
+    std::vector<float> storage;
+    unsigned capacity, head;
+};
+
+// Ring::push on storage of 2*capacity samples owned by the caller.
+// Takes every stride-th sample of data, n is the count taken.
+template<class T>
+void mirror_push(T *storage, unsigned capacity, unsigned &head, const T *data, unsigned n,
+        unsigned stride = 1);
+
+// peak search over a normalized mse curve of length size. scans the lags
+// i in [low, high] that are the minimum of mse[i-window .. i+window] and
+// returns the deepest one below 1.0 (value is set to its mse), or 0 if there
+// is none. The scan stops at the first peak below cutoff.
+unsigned find_peak(const float *mse, unsigned size, unsigned low, unsigned high,
+        unsigned window, float cutoff, float &value);
+
+// turns the autocorrelation r of the window time (size samples whose squares
+// sum to energy) in place into the mean square error by lag, normalized by its
+// cumulative average. Only the first count lags are converted, the rest are
+// set to 2. Returns the voicing, the highest correlation relative to the
+// energy of the overlap at the lags [low, high]. The samples are float or int16_t.
+template<class T>
+float autocorrelation_to_mse(const T *time, float *r, unsigned size, unsigned count,
+        unsigned low, unsigned high, float energy);
+
+// the same for the cross-correlation c of left and right (max samples each,
+// squares summing to energy), where c[i] is the correlation at lag max - i.
+// The mse is written by lag to mse[0 .. size), lags above max are set to 2.
+// Returns the voicing at the lags [low, max].
+template<class T>
+float correlation_to_mse(const T *left, const T *right, const float *c, unsigned max,
+        unsigned low, float energy, float *mse, unsigned size);
+
+// bottom of the parabola through (-1, left), (0, mid) and (1, right),
+// or 0 if it isn't between -1 and 1.
+float parabola_bottom(float left, float mid, float right);
+
 class Detector {
 
     // pitch detector. Designed to detect the pitch of a single source
@@ -1445,29 +2180,102 @@ public:
     float quietThreshold;
     float momentumDecay;
 
+    // incremental mode updates the lag products from the samples entering and
+    // leaving the analysis windows instead of recomputing them with fft.
+    // only lags up to max (+ the peak window) are kept. the products are
+    // recomputed exactly every refreshInterval feeds to bound the float drift,
+    // and whenever a feed is longer than max samples.
+    bool incremental;
+    unsigned refreshInterval;
+
+    // coarse to fine search. With decimation > 1 the pitch is searched on a
+    // low-passed copy of the signal decimated by that factor, and only the
+    // lags around the coarse period are refined at the full rate.
+    // decimation = 1 is the exhaustive search. The coarse search ignores
+    // incremental. refine = 0 takes the coarse period as is.
+    unsigned decimation;
+    bool refine;
+
+    // how many samples after the analysis point the estimate may look at.
+    // It is clamped to [size/2, size], 0 means size. Smaller values cut
+    // the latency of the estimates, the lag of get / get2 is the same.
+    unsigned lookahead;
+
     // the pitch is updated only if the buffer has been fed at least <size> samples.
-    // time complexity of feed is O(size * log(size)).
+    // time complexity of feed is O(size * log(size)),
+    // or O(data.size() * max) in incremental mode.
+    // all the memory feed needs is allocated in the constructor / reset,
+    // so it doesn't allocate as long as data.size() <= size.
     void feed(const std::vector<float> &data);
     
     // clear previous information.
     void reset();
 
-    // get one period from the buffer. The buffer has a lag of size samples.
-    std::vector<float> get(unsigned amount = 0);
+    // clear previous information and change the input rate & search range.
+    // memory is reallocated only if the sizes change, so one detector can
+    // be reused across files. tweakable variables keep their values.
+    void reset(unsigned frameRate, float lower = 60, float upper = 900);
+
+    // index of the sample the current estimate belongs to, counting from the
+    // first fed sample. Negative until the detector has been fed lookahead samples.
+    int64_t position();
+
+    // samples from the analysis point to the end of the latest feed,
+    // the lookahead clamped to [size/2, size].
+    unsigned delay();
+
+    // get one period from the buffer. The buffer has a lag of lookahead samples.
+    // the views point into the buffer and are valid until the next feed or reset.
+    View get(unsigned amount = 0);
     
     // get two periods from the buffer. One extending after the lag and one before.
-    std::vector<float> get2(unsigned amount = 0);
+    View get2(unsigned amount = 0);
 
     // get the momentum mse graph. for debugging purposes.
     std::vector<float> get_mse();
 
+    // the variance of the max samples after the analysis point, the one
+    // compared with quietThreshold.
+    float get_power();
+
+    // the input sampling rate, Hz.
+    unsigned get_rate() const;
+
 private:
 
-    const unsigned rate;
+    unsigned rate;
     unsigned min, max, trust;
     float power;
+    float lowerBound, upperBound;
+
+    // size everything for the given rate and range.
+    void configure(unsigned frameRate, float lower, float upper);
+
+    Ring buffer;
+
+    // absolute index of the sample after the last one in buffer.
+    // the zeros the buffer is initialized with are counted as well.
+    uint64_t fed;
+
+    // lag products kept by the incremental mode, indexed by lag.
+    // at = 0 means there is nothing to update and the next feed is exact.
+    struct Lags {
+        std::vector<double> r;
+        double energy = 0.0;
+        uint64_t at = 0;
+        unsigned age = 0;
+    };
 
-    std::deque<float> buffer;
+    // autocorrelation of the window [at - size, at).
+    Lags autoLags;
+    // cross-correlation around the point at: r[k] = sum(p = at-k .. at-1, x[p]*x[p+k]).
+    // energy is taken over [at - max, at + max).
+    Lags crossLags;
+    std::vector<float> delta;
+
+    // x[0] is the sample with absolute index begin.
+    void update_autocorrelation(const float *x, uint64_t begin, uint64_t end);
+    void update_correlation(const float *x, uint64_t begin, uint64_t point);
 
     struct Info {
         unsigned move, top;
@@ -1475,535 +2283,4728 @@ private:
         float voiced, value;
     };
 
-    Info momentum;
+    // one and two are the mse graphs of the current feed at
+    // the middle and the end of data.
+    Info momentum, one, two;
     std::vector<float> nonorm;
 
-};
+    // workspace for the correlations.
+    std::vector<std::complex<float> > spectrum;
+    std::vector<float> scratch;
 
-}   // namespace change
+    // the detector for the decimated signal, if there is one. A vector
+    // keeps Detector copyable. antialias is the decimation filter.
+    std::vector<Detector> coarse;
+    std::vector<float> antialias;
+    std::vector<float> decimated;
 
+    void setup_coarse();
+    void feed_coarse(unsigned n);
 
+    // the decimation of the previous feed. The momentum, the trust and the
+    // lag products of one search are stale for the other, so they are
+    // dropped whenever the decimation changes. 0 after a reset.
+    unsigned searched;
 
-namespace change {
+    // filter & decimate the buffered samples from the absolute index from on.
+    void decimate(uint64_t from);
 
-Detector::Detector(unsigned frameRate, float lower, float upper) :
-    peakWindowMax(5),
-    trustLimit(5),
-    minCutoff(0.25f),
-    voicedThreshold(0.3f),
-    quietThreshold(5e-5f),
-    momentumDecay(0.35f),
-    rate(frameRate)
-{
-    if(lower > upper) std::swap(lower, upper);
+    // drop the search state but keep the buffer.
+    void restart();
 
-    min = std::floor(rate / upper);
-    max = std::ceil(rate / lower);
+protected:
 
-    size = 2 * max;
-    for(unsigned i=0; i < 2*size; i++) buffer.push_back(0.0f);
+    // the transforms of feed, math::correlation and math::autocorrelation
+    // after a configure. FixedDetector binds fixed_fft instances instead.
+    void (*correlator)(const float *a, unsigned n, const float *b, unsigned m,
+            float *r, unsigned count, std::complex<float> *work);
+    void (*autocorrelator)(const float *a, unsigned n, const float *b, unsigned m,
+            float *ra, float *rb, std::complex<float> *work);
+};
 
-    trust = 0;
+template<unsigned Rate = 44100, unsigned Lower = 60, unsigned Upper = 900>
+class FixedDetector : public Detector {
 
-    momentum.mse.resize(size, 0.0f);
-    nonorm.resize(size, 0.0f);
-    momentum.top = 0;
-}
+    // Detector with the input rate and the search range (Hz) fixed at compile
+    // time. The sizes are constants and feed runs fixed_fft instances of them,
+    // everything else is Detector's, so the estimates are the same. A reset
+    // to another rate or range makes it a runtime Detector again.
 
-float Detector::real_period(){
-    if(pitch == 0.0f) return 0.0f;
-    return rate / pitch;
-}
+public:
 
-void Detector::feed(const std::vector<float> &data){
-    
-    for(float i : data) buffer.push_back(i);
+    static_assert(Lower > 0 && Lower < Upper && Upper <= Rate, "bad search range");
 
-    while(buffer.size() > 2 * size) buffer.pop_front();
+    // the lags go up to maxLag, see Detector::configure.
+    static constexpr unsigned maxLag = (Rate + Lower - 1) / Lower;
+    static constexpr unsigned windowSize = 2 * maxLag;
 
-    // check if the signal is quiet
+    FixedDetector() : Detector(Rate, Lower, Upper) {
+        assert(size == windowSize);
+        correlator = math::fixed_correlation<math::correlation_size(maxLag, maxLag)>;
+        autocorrelator = math::fixed_autocorrelation<math::autocorrelation_size(windowSize, windowSize)>;
+    }
+};
 
-    {
-        float avg = 0.0f, sum = 0.0f;
+class IntegerDetector {
 
-        for(unsigned i=0; i<max; i++) avg += buffer[size + i];
-        avg /= max;
+    // Detector on 16 bit pcm. The samples stay int16 in the buffer and the
+    // lag products are exact integer dot products (math::dot), computed
+    // directly for only the lags the search looks at, [0, max + peak window].
+    // Only the mse graphs are float. Otherwise it is the default Detector:
+    // autocorrelation until the pitch is trusted, cross-correlation after.
+    // feed takes a stride, so every channel of an interleaved block can be
+    // fed to its own detector without unpacking the block to float.
 
-        for(unsigned i=0; i<max; i++) sum += (buffer[size+i] - avg) * (buffer[size+i] - avg);
-        sum /= max;
+public:
 
-        power = sum;
+    IntegerDetector(
+            unsigned frameRate = 44100, // input sampling rate, Hz
+            float lower = 60,           // pitch search range lower bound, Hz
+            float upper = 900);         // pitch search range upper bound, Hz
 
-        quiet = sum < quietThreshold;
-    }
+    // the same as in Detector.
 
-    if(quiet){
+    unsigned size;
 
-        voiced = 0;
-        confidence = 1;
-        trust = 0;
-        
-        float oldWeight = std::pow(momentumDecay, (float)data.size() / size);
+    unsigned period = 0;
+    float pitch = 0;
+    float confidence = 0;
+    bool voiced = 0;
+    bool quiet = 1;
 
-        for(float &i : nonorm) i *= oldWeight;
+    float real_period();
 
-        return;
-    }
+    // tweakable variables. Look up the default values in the initializer.
+    // quietThreshold is on the float scale, like in Detector.
 
-    Info one, two;
+    unsigned peakWindowMax;
+    unsigned trustLimit;
 
-    // calculate mean square errors and normalize them by dividing
-    // by the cumulative average. I think the YIN algorithm does
-    // a similar thing. Not sure though.
+    float minCutoff;
+    float voicedThreshold;
+    float quietThreshold;
+    float momentumDecay;
 
-    // autocorrelation returns ac[j] = sum(i = 0..n, audio[i]*audio[j+i]).
-    // while it is in of itself ok for pitch detection, mse seems
-    // to work better. We can easily convert autocorrelation to mse.
-   
-    // if the previous feeds have been voiced, we use cross-correlation between
-    // the left and right side of the current point insted of autocorrelation.
-    // While autocorrelation performs better on initially picking up the
-    // pitch, cross-correlation is more robust during longer voiced segments.
+    // n samples, data[0], data[stride], ... data[(n-1)*stride].
+    // time complexity O(size * max), doesn't allocate.
+    void feed(const int16_t *data, unsigned n, unsigned stride = 1);
+    void feed(const std::vector<int16_t> &data);
 
-    // The approaches should be roughly equally fast as autocorrelation
-    // only requires 1 fft operation per vector insted of 2 but cross-correlation
-    // operates on vectors that are half the size.
-    
-    if(trust > trustLimit){
-   
-        one.move = data.size() / 2;
-        two.move = data.size() - one.move;
-        
-        // pitch detected. Follow it with correlation.
+    void reset();
+    void reset(unsigned frameRate, float lower = 60, float upper = 900);
 
-        std::vector<float> left1(max), right1(max);
-        std::vector<float> left2(max), right2(max);
+private:
 
-        for(unsigned i=0; i<max; i++){
-            left1[i] = buffer[size + i - two.move - max];
-            right1[i] = buffer[size + i - two.move];
-            left2[i] = buffer[size + i - max];
-            right2[i] = buffer[size + i];
-        }
+    unsigned rate;
+    unsigned min, max, trust;
+    float power;
 
-        auto process_mse = [&](
-                std::vector<float> &left,
-                std::vector<float> &right,
-                Info &x) -> void
-        {
+    void configure(unsigned frameRate, float lower, float upper);
 
-            // calculate correlation
+    // a Ring of 2*size samples.
+    std::vector<int16_t> storage;
+    unsigned head;
 
-            x.mse = math::correlation(left, right);
-            
-            // convert to mse
+    struct Info {
+        unsigned move, top;
+        std::vector<float> mse;
+        float voiced, value;
+    };
 
-            float sum = 0.0f;
-            for(float i : left) sum += i*i;
-            for(float i : right) sum += i*i;
-            
-            for(unsigned i=0; i<max; i++){
-                
-                if(i+min <= max && sum != 0.0f)
-                    x.voiced = std::max(x.voiced, x.mse[i] / sum);
-                
-                x.mse[i] = (sum - 2 * x.mse[i]) / (max - i);
-                sum -= left[i]*left[i] + right[max-i-1]*right[max-i-1];
-            }
+    Info momentum, one, two;
+    std::vector<float> nonorm;
+    std::vector<float> scratch;
 
-            x.mse.resize(max+1);
-            std::reverse(x.mse.begin(), x.mse.end());
+    void normalize(const std::vector<float> &from, std::vector<float> &to);
+    void apply_momentum(const Info &x);
+};
 
-            // normalize
+class DetectorBank {
 
-            x.mse[0] = 2.0f;
-            sum = 0.0f;
-            for(unsigned i=1; i<=max; i++){
-                sum += x.mse[i];
-                if(sum != 0.0f) x.mse[i] *= i / sum;
-            }
+    // lanes independent streams tracked with the same parameters, e.g. the
+    // channels of a file or a batch of files. The buffers and mse graphs are
+    // lane-interleaved (sample i of stream k is at [i*lanes + k]) so every
+    // step from the fft to the peak search runs across the streams in simd.
 
-            x.mse.resize(size, 2.0f);
-        };
+    // each stream behaves like a Detector that never builds trust, i.e. the
+    // pitch is always probed with autocorrelation. The bank has no cross
+    // correlation or incremental mode since those would let lanes diverge.
+    // It pays off from about 8 streams on; for a single stream use Detector.
 
-        process_mse(left1, right1, one);
-        process_mse(left2, right2, two);
+public:
+
+    DetectorBank(
+            unsigned lanes,             // number of streams
+            unsigned frameRate = 44100, // input sampling rate, Hz
+            float lower = 60,           // pitch search range lower bound, Hz
+            float upper = 900);         // pitch search range upper bound, Hz
+
+    // Access only.
+    unsigned lanes, size;
+
+    // per stream results, updated after each feed. See Detector.
+
+    std::vector<unsigned> period;
+    std::vector<float> pitch;
+    std::vector<float> confidence;
+    std::vector<uint8_t> voiced;
+    std::vector<uint8_t> quiet;
+
+    // tweakable variables, same meaning and defaults as in Detector.
+
+    unsigned peakWindowMax;
+
+    float minCutoff;
+    float voicedThreshold;
+    float quietThreshold;
+    float momentumDecay;
+
+    // data holds n samples of every stream, interleaved like the channels of
+    // a wave file: data[i*lanes + k] is sample i of stream k.
+    // doesn't allocate.
+    void feed(const float *data, unsigned n);
+    void feed(const std::vector<float> &data);
+
+    // clear previous information.
+    void reset();
+
+private:
+
+    unsigned rate;
+    unsigned min, max;
+
+    Ring buffer;
+
+    // lane-interleaved mse graphs, size * lanes each.
+    std::vector<float> one, two, nonorm, momentum;
+
+    // lane-interleaved spectrum of the autocorrelations.
+    std::vector<float> re, im;
+
+    // per lane workspace.
+    std::vector<float> power, sum, voiced1, voiced2, value, lowest;
+    std::vector<unsigned> top, done;
+};
+
+// part of a recording, samples [begin, end).
+struct Region {
+    uint64_t begin, end;
+};
+
+class Prescan {
+
+    // finds the parts of a recording worth running the detector on. The
+    // envelope is the variance of blocks of samples. A region starts where it
+    // rises above the enter level and ends where it falls below the exit level,
+    // so short dips don't split it. Regions are padded and merged where they
+    // overlap.
+
+    // by default the levels match Detector::quietThreshold, so only audio the
+    // detector would find quiet anyway is skipped. For noisy recordings the
+    // levels can be raised relative to the noise floor of each recording;
+    // that skips more but may cut quiet speech.
+
+public:
+
+    Prescan(unsigned block = 256);
+
+    // tweakable variables. Look up the default values in the initializer.
+
+    unsigned block;     // samples per envelope value. The detector's quiet check
+                        // is over size / 2 samples, use that for the same levels
+    unsigned pad;       // samples added to both sides. use at least 2 * detector size
+
+    float enter;        // levels, same scale as Detector::quietThreshold
+    float exit;
+
+    float floorQuantile;    // the noise floor is this quantile of the envelope
+    float enterOverFloor;   // if nonzero, the levels are at least these
+    float exitOverFloor;    // multiples of the noise floor
+
+    // the regions in order. Fills envelope and skipped.
+    std::vector<Region> scan(const float *waves, unsigned n);
+    std::vector<Region> scan(const std::vector<float> &waves);
+
+    // the same a part at a time, so the recording doesn't have to be in
+    // memory: clear, append the samples in order, then finish. Every part
+    // but the last must be a multiple of block samples.
+    void clear();
+    void append(const float *waves, unsigned n);
+    std::vector<Region> finish();
+
+    // results of the latest scan. Access only.
+    std::vector<float> envelope;
+    float noiseFloor = 0;   // only if the levels are relative
+    float skipped = 0;  // fraction of the samples outside the regions
+
+private:
+
+    std::vector<float> sorted;
+    uint64_t appended = 0;
+};
+
+// pitch estimate of one hop.
+struct Estimate {
+    uint64_t sample;    // index of the sample it belongs to, from the start of the stream
+    float pitch;
+    float confidence;
+    bool voiced;
+};
+
+class RealtimeDetector {
+
+    // Detector for live input. Takes samples in whatever chunks they come,
+    // runs the detector every hop samples and stamps the estimates with the
+    // sample they belong to. If a feed takes longer than the budget the search
+    // is degraded (decimated lag grid, then no refinement) and restored
+    // again once there is time to spare.
+
+public:
+
+    RealtimeDetector(
+            unsigned frameRate = 44100, // input sampling rate, Hz
+            unsigned hop = 128,         // samples per feed
+            unsigned lookahead = 0,     // see Detector::lookahead
+            float lower = 60,           // pitch search range lower bound, Hz
+            float upper = 900);         // pitch search range upper bound, Hz
+
+    // tweak the search parameters here, except decimation & refine
+    // which are set by the degradation level.
+    Detector detector;
+
+    // compute budget of one feed in microseconds. Defaults to half
+    // the duration of a hop. 0 disables the degradation.
+    float budget;
+
+    // consecutive feeds under half the budget before going a level back up.
+    unsigned recoverAfter;
+
+    // append samples. The estimates of the completed hops are appended to out.
+    // doesn't allocate unless out has to grow.
+    void push(const float *data, unsigned n, std::vector<Estimate> &out);
+
+    // clear previous information and the counters.
+    void reset();
+
+    // counters. Access only.
+
+    uint64_t hops = 0;          // feeds so far
+    uint64_t misses = 0;        // feeds over the budget
+    float lastMicros = 0;       // compute time of the latest feed
+    float maxMicros = 0;        // worst compute time
+    double totalMicros = 0;     // for the mean
+    unsigned level = 0;         // degradation level, 0 is the full search
+
+    // samples between the input of a sample and the estimate that belongs
+    // to it, without the compute time: the lookahead plus the hop fill.
+    unsigned latency();
+
+    // latency() plus the mean compute time, in milliseconds.
+    float latency_ms();
+
+    // (decimation, refine) of every degradation level.
+    static constexpr unsigned levels = 4;
+    static const std::pair<unsigned, bool> degradation[levels];
+
+private:
+
+    unsigned rate, hop;
+    unsigned calm;
+
+    std::vector<float> pending;
+};
+
+class SegmentedDetector {
+
+    // runs a Detector over one long recording on several threads. The
+    // recording is split into segments, and every segment is detected on its
+    // own after warming up a copy of the detector on the samples before it.
+    // The warm-up lets the buffer, the momentum and the trust converge, so the
+    // stitched track matches a sequential run up to rare hops around segment
+    // boundaries.
+
+public:
+
+    // the prototype gives the rate and the tweakable variables.
+    SegmentedDetector(const Detector &prototype = Detector(), unsigned hop = 128);
+
+    Detector prototype;
+
+    // tweakable variables. Look up the default values in the initializer.
+
+    unsigned threads;   // 0 means all the cores
+    unsigned segment;   // samples per segment, 0 is one segment: the sequential run
+    unsigned warmup;    // samples fed before a segment, at least 2 * size
+
+    // the estimate of every hop with a non-negative position, in order.
+    // The segments don't depend on the threads, so neither does the result.
+    std::vector<Estimate> track(const float *waves, unsigned n);
+    std::vector<Estimate> track(const std::vector<float> &waves);
+
+private:
+
+    unsigned hop;
+
+    // detect the hops [first, last), feeding from the hop begin on.
+    void detect(const float *waves, unsigned begin, unsigned first, unsigned last,
+            std::vector<Estimate> &out, std::vector<uint8_t> &valid);
+};
+
+class Tracker {
+
+    // offline pitch tracker for whole recordings. Every frame is analyzed on
+    // its own, so the candidate periods of the frames are extracted in
+    // parallel. The track is then picked with viterbi over the candidates and
+    // an unvoiced state, which keeps it continuous and avoids octave jumps.
+
+public:
+
+    Tracker(
+            unsigned frameRate = 44100, // input sampling rate, Hz
+            unsigned hop = 128,         // samples between frames
+            float lower = 60,           // pitch search range lower bound, Hz
+            float upper = 900);         // pitch search range upper bound, Hz
+
+    // frames are size samples centered at t * hop. Access only.
+    unsigned size;
+
+    // tweakable variables. Look up the default values in the initializer.
+
+    unsigned candidates;    // kept per frame
+    unsigned threads;       // 0 means all the cores
+    unsigned peakWindowMax;
+
+    float minCutoff;
+    float voicedThreshold;
+    float quietThreshold;
+
+    // the costs. Voicing on the wrong side of voicedThreshold costs voicingCost
+    // per unit for both states, and the candidates cost the difference of their
+    // normalized mse to the best one of the frame. So each frame alone gets the
+    // same decision as the detector.
+    float voicingCost;
+    float octaveCost;       // per octave between consecutive voiced frames
+    float transitionCost;   // voiced <-> unvoiced
+
+    // estimate of every frame, estimate t belongs to the sample t * hop.
+    std::vector<Estimate> track(const float *waves, unsigned n);
+    std::vector<Estimate> track(const std::vector<float> &waves);
+
+private:
+
+    unsigned rate, hop;
+    unsigned min, max;
+
+    struct Candidate {
+        float period, value;
+    };
+
+    struct Frame {
+        float voicing;
+        unsigned count;     // number of candidates
+    };
+
+    // analyze the frames [first, last). frame t owns candidates [t*candidates, ...).
+    void analyze(const float *waves, unsigned n, unsigned first, unsigned last,
+            std::vector<Frame> &frames, std::vector<Candidate> &found);
+};
+
+}   // namespace change
+
+
+
+namespace change {
+
+Ring::Ring(unsigned capacity_){
+    resize(capacity_);
+}
+
+void Ring::resize(unsigned capacity_){
+    capacity = capacity_;
+    head = 0;
+    storage.assign(2*capacity, 0.0f);
+}
+
+void Ring::clear(){
+    head = 0;
+    std::fill(storage.begin(), storage.end(), 0.0f);
+}
+
+void Ring::push(const float *data, unsigned n){
+    mirror_push(storage.data(), capacity, head, data, n);
+}
+
+template<class T>
+void mirror_push(T *storage, unsigned capacity, unsigned &head, const T *data, unsigned n,
+        unsigned stride){
+
+    if(capacity == 0) return;
+
+    if(n > capacity){
+        data += (size_t)(n - capacity) * stride;
+        n = capacity;
+    }
+
+    // the new samples go to [head, head + n) mod capacity, written to both halves.
+    unsigned first = std::min(n, capacity - head);
+
+    if(stride == 1){
+        std::copy(data, data + first, storage + head);
+        std::copy(data, data + first, storage + head + capacity);
+        std::copy(data + first, data + n, storage);
+        std::copy(data + first, data + n, storage + capacity);
+    }
+    else {
+        for(unsigned i=0; i<n; i++){
+            unsigned j = i < first ? head + i : i - first;
+            storage[j] = storage[j + capacity] = data[(size_t)i * stride];
+        }
+    }
+
+    head = (head + n) % capacity;
+}
+
+Detector::Detector(unsigned frameRate, float lower, float upper) :
+    peakWindowMax(5),
+    trustLimit(5),
+    minCutoff(0.25f),
+    voicedThreshold(0.3f),
+    quietThreshold(5e-5f),
+    momentumDecay(0.35f),
+    incremental(0),
+    refreshInterval(64),
+    decimation(1),
+    refine(1),
+    lookahead(0)
+{
+    configure(frameRate, lower, upper);
+    reset();
+}
+
+void Detector::configure(unsigned frameRate, float lower, float upper){
+
+    if(lower > upper) std::swap(lower, upper);
+
+    rate = frameRate;
+    min = std::floor(rate / upper);
+    max = std::ceil(rate / lower);
+    lowerBound = lower;
+    upperBound = upper;
+
+    size = 2 * max;
+    buffer.resize(2*size);
+    coarse.clear();
+
+    momentum.mse.assign(size, 0.0f);
+    one.mse.assign(size, 0.0f);
+    two.mse.assign(size, 0.0f);
+    nonorm.assign(size, 0.0f);
+
+    spectrum.resize(std::max(
+        math::autocorrelation_size(size, size),
+        math::correlation_size(max, max)));
+    scratch.resize(size);
+
+    delta.reserve(size + 1);
+    autoLags.r.reserve(size + 1);
+    crossLags.r.reserve(size + 1);
+
+    correlator = math::correlation;
+    autocorrelator = math::autocorrelation;
+}
+
+float Detector::real_period(){
+    if(pitch == 0.0f) return 0.0f;
+    return rate / pitch;
+}
+
+void Detector::feed(const std::vector<float> &data){
+    
+    buffer.push(data.data(), data.size());
+
+    fed += data.size();
+
+    // the whole history of 2*size samples. history[0] is the sample number begin.
+    // the analysis point is history[at].
+
+    const float *history = buffer.data();
+    const uint64_t begin = fed - 2*size;
+    const unsigned at = 2*size - delay();
+
+    // check if the signal is quiet
+
+    {
+        float avg = 0.0f, sum = 0.0f;
+
+        for(unsigned i=0; i<max; i++) avg += history[at + i];
+        avg /= max;
+
+        for(unsigned i=0; i<max; i++) sum += (history[at+i] - avg) * (history[at+i] - avg);
+        sum /= max;
+
+        power = sum;
+
+        quiet = sum < quietThreshold;
+    }
+
+    if(decimation != searched){
+        if(searched) restart();
+        searched = decimation;
+    }
+
+    if(decimation > 1){
+        feed_coarse(data.size());
+        return;
+    }
+
+    if(quiet){
+
+        voiced = 0;
+        confidence = 1;
+        trust = 0;
+        
+        float oldWeight = std::pow(momentumDecay, (float)data.size() / size);
+
+        for(float &i : nonorm) i *= oldWeight;
+
+        return;
+    }
+
+    one.voiced = two.voiced = 0.0f;
+
+    // calculate mean square errors and normalize them by dividing
+    // by the cumulative average. I think the YIN algorithm does
+    // a similar thing. Not sure though.
+
+    // autocorrelation returns ac[j] = sum(i = 0..n, audio[i]*audio[j+i]).
+    // while it is in of itself ok for pitch detection, mse seems
+    // to work better. We can easily convert autocorrelation to mse.
+   
+    // if the previous feeds have been voiced, we use cross-correlation between
+    // the left and right side of the current point insted of autocorrelation.
+    // While autocorrelation performs better on initially picking up the
+    // pitch, cross-correlation is more robust during longer voiced segments.
+
+    // The approaches should be roughly equally fast as autocorrelation
+    // only requires 1 fft operation per vector insted of 2 but cross-correlation
+    // operates on vectors that are half the size.
+    
+    if(trust > trustLimit){
+   
+        one.move = data.size() / 2;
+        two.move = data.size() - one.move;
+        
+        // pitch detected. Follow it with correlation.
+
+        // max samples before and after the point, straight from the buffer.
+
+        const float *left1 = history + at - two.move - max, *right1 = history + at - two.move;
+        const float *left2 = history + at - max, *right2 = history + at;
+
+        // calculate correlation. returns the energy of left and right.
+
+        auto correlate = [&](
+                const float *left,
+                const float *right,
+                uint64_t point) -> float
+        {
+            // scratch[i] is the correlation at lag max - i.
+
+            if(incremental){
+                update_correlation(history, begin, point);
+                for(unsigned i=0; i<max; i++) scratch[i] = crossLags.r[max - i];
+                return crossLags.energy;
+            }
+
+            correlator(left, max, right, max, scratch.data(), max, spectrum.data());
+
+            float sum = 0.0f;
+            for(unsigned i=0; i<max; i++) sum += left[i]*left[i];
+            for(unsigned i=0; i<max; i++) sum += right[i]*right[i];
+            return sum;
+        };
+
+        // scratch is shared, so each correlation is processed right away.
+
+        float energy1 = correlate(left1, right1, begin + at - two.move);
+        one.voiced = correlation_to_mse(left1, right1, scratch.data(), max, min, energy1,
+                one.mse.data(), size);
+
+        float energy2 = correlate(left2, right2, begin + at);
+        two.voiced = correlation_to_mse(left2, right2, scratch.data(), max, min, energy2,
+                two.mse.data(), size);
     } 
     else {
 
-        // trying to pick up the pitch. initial probing with autocorrelation.
-        
-        one.move = data.size() / 2;
-        two.move = data.size() - one.move;
+        // trying to pick up the pitch. initial probing with autocorrelation.
+        // the windows are the latest samples whatever the lookahead.
+        
+        one.move = data.size() / 2;
+        two.move = data.size() - one.move;
+
+        const float *onev = history + size - two.move, *twov = history + size;
+
+        // lags >= count are not calculated in incremental mode.
+        unsigned count = size;
+        float energy1 = 0.0f, energy2 = 0.0f;
+
+        if(incremental){
+
+            count = autoLags.r.size();
+
+            auto copy_lags = [&](Info &x) -> void {
+                for(unsigned i=0; i<count; i++) x.mse[i] = autoLags.r[i];
+            };
+
+            update_autocorrelation(history, begin, fed - two.move);
+            copy_lags(one);
+            energy1 = autoLags.energy;
+
+            update_autocorrelation(history, begin, fed);
+            copy_lags(two);
+            energy2 = autoLags.energy;
+        }
+        else {
+            autocorrelator(onev, size, twov, size,
+                    one.mse.data(), two.mse.data(), spectrum.data());
+
+            for(unsigned i=0; i<size; i++) energy1 += onev[i]*onev[i];
+            for(unsigned i=0; i<size; i++) energy2 += twov[i]*twov[i];
+        }
+
+        one.voiced = autocorrelation_to_mse(onev, one.mse.data(), size, count, min, max, energy1);
+        two.voiced = autocorrelation_to_mse(twov, two.mse.data(), size, count, min, max, energy2);
+    }
+
+    // to may be the same as from.
+    auto normalize = [&](const std::vector<float> &from, std::vector<float> &to) -> void {
+
+        float avg = 0.0f;
+        for(unsigned i=min; i<max; i++) avg += from[i];
+        avg /= (max-min);
+
+        if(avg > 1e-18){
+            float iavg = 1.0f / avg;
+            for(unsigned i=0; i<size; i++) to[i] = from[i] * iavg;
+        } else {
+            for(unsigned i=0; i<size; i++) to[i] = 2.0f;
+        }
+    };
+    
+    auto find_peak = [&](Info &x) -> void {
+        unsigned window = std::min(min/2, peakWindowMax);
+        x.top = change::find_peak(x.mse.data(), size, min, max, window, minCutoff, x.value);
+    };
+
+    normalize(one.mse, one.mse);
+    normalize(two.mse, two.mse);
+    
+    // the unnormalized momentum is updated in place and
+    // normalized into momentum.mse at the end.
+
+    auto apply_momentum = [&](Info &x){
+
+        float newWeight = x.voiced * power;
+        float oldWeight = std::pow(momentumDecay, (float)x.move / size);
+
+        for(unsigned i=0; i<size; i++){
+            nonorm[i] = newWeight * x.mse[i] + oldWeight * nonorm[i];
+        }
+   
+        momentum.voiced = x.voiced;
+    };
+
+    apply_momentum(one);
+    apply_momentum(two);
+    normalize(nonorm, momentum.mse);
+
+    find_peak(momentum);
+
+    Info &best = momentum;
+
+    // classify.
+
+    if(best.voiced > voicedThreshold){
+        
+        confidence = 1.0f - best.value;
+
+        voiced = 1;
+        period = best.top;
+
+        // quadratic interpolation is useful for high pitches
+
+        // construct a parabola using the three points around
+        // the peak and take its bottom.
+
+        pitch = (float)rate / period;
+        if(period > 1 && period + 1 <= max){
+            float bottom = parabola_bottom(best.mse[period-1], best.mse[period], best.mse[period+1]);
+            pitch = (float)rate / (period + bottom);
+        }
+
+        trust++;
+
+    } else {
+
+        confidence = 1.0f - best.voiced;
+        voiced = 0;
+        trust = 0;
+
+    }
+}
+
+void Detector::update_autocorrelation(const float *x, uint64_t begin, uint64_t end){
+
+    const unsigned lags = std::min(size - 1, max + peakWindowMax + 1);
+    const uint64_t from = autoLags.at;
+
+    bool exact = !from || end < from || end - from > max || from < begin + size
+        || autoLags.age >= refreshInterval || autoLags.r.size() != lags + 1;
+
+    if(exact){
+
+        const float *window = x + (end - size - begin);
+        autocorrelator(window, size, nullptr, 0, scratch.data(), nullptr, spectrum.data());
+
+        autoLags.r.assign(scratch.begin(), scratch.begin() + lags + 1);
+        autoLags.energy = 0.0;
+        for(unsigned i=0; i<size; i++) autoLags.energy += (double)window[i]*window[i];
+        autoLags.age = 0;
+
+    } else {
+
+        const unsigned h = end - from;
+        const float *old = x + (from - size - begin);
+        const float *now = x + (end - size - begin);
+
+        delta.assign(lags + 1, 0.0f);
+        float *__restrict d = delta.data();
+        double energy = 0.0;
+
+        // pairs (i, i+k) whose first sample leaves the window
+        for(unsigned i=0; i<h; i++){
+            const float v = old[i];
+            math::multiply_add(d, old + i, -v, std::min(lags, size - 1 - i) + 1);
+            energy -= (double)v*v;
+        }
+
+        // pairs (j-k, j) whose second sample enters the window
+        for(unsigned j=size-h; j<size; j++){
+            const float v = now[j];
+            math::multiply_add_reverse(d, now + j, v, std::min(lags, j) + 1);
+            energy += (double)v*v;
+        }
+
+        for(unsigned k=0; k<=lags; k++) autoLags.r[k] += d[k];
+        autoLags.energy += energy;
+        autoLags.age++;
+    }
+
+    autoLags.at = end;
+}
+
+void Detector::update_correlation(const float *x, uint64_t begin, uint64_t point){
+
+    const uint64_t from = crossLags.at;
+
+    bool exact = !from || point < from || point - from > max || from < begin + max
+        || crossLags.age >= refreshInterval || crossLags.r.size() != max + 1;
+
+    if(exact){
+
+        const float *left = x + (point - max - begin);
+
+        // c[n] = sum(i, left[i]*right[i-n]), the lag is max - n.
+        float *c = scratch.data();
+        correlator(left, max, left + max, max, c, max, spectrum.data());
+
+        crossLags.r.assign(max + 1, 0.0);
+        for(unsigned k=1; k<=max; k++) crossLags.r[k] = c[max - k];
+
+        crossLags.energy = 0.0;
+        for(unsigned i=0; i<2*max; i++) crossLags.energy += (double)left[i]*left[i];
+        crossLags.age = 0;
+
+    } else {
+
+        const unsigned h = point - from;
+        const float *a = x + (from - begin);
+
+        delta.assign(max + 1, 0.0f);
+        float *__restrict d = delta.data();
+        double energy = 0.0;
+
+        // products starting at or after the old point are added
+        for(unsigned q=0; q<h; q++){
+            const unsigned k = std::max(1u, h-q);
+            math::multiply_add(d + k, a + q + k, a[q], max + 1 - k);
+        }
+
+        // products starting at point - k are removed
+        for(unsigned m=1; m<=max; m++){
+            const float v = a[-(int64_t)m];
+            math::multiply_add(d + m, a, -v, std::min(max, m + h - 1) + 1 - m);
+        }
+
+        for(unsigned q=0; q<h; q++){
+            energy += (double)a[max+q]*a[max+q];
+            energy -= (double)a[q-(int64_t)max]*a[q-(int64_t)max];
+        }
+
+        for(unsigned k=1; k<=max; k++) crossLags.r[k] += d[k];
+        crossLags.energy += energy;
+        crossLags.age++;
+    }
+
+    crossLags.at = point;
+}
+
+unsigned find_peak(const float *mse, unsigned size, unsigned low, unsigned high,
+        unsigned window, float cutoff, float &value){
+
+    unsigned top = 0;
+    value = 1.0f;
+
+    // only lags that beat the current best need the neighbourhood check, so
+    // the scan is a single compare per lag on most of the curve.
+
+    for(unsigned i=std::max(low, window); i<=high && i+window+1<size; i++){
+
+        if(!(mse[i] < value)) continue;
+
+        // index i is a minimum in the surrounding range.
+        bool minimum = 1;
+        for(unsigned j=i-window; j<=i+window; j++) minimum &= !(mse[j] < mse[i]);
+        if(!minimum) continue;
+
+        value = mse[i];
+        top = i;
+        if(value < cutoff) break;
+    }
+
+    return top;
+}
+
+template<class T>
+float autocorrelation_to_mse(const T *time, float *r, unsigned size, unsigned count,
+        unsigned low, unsigned high, float energy){
+
+    // convert to mse
+
+    float sum = 2 * energy, voiced = 0.0f;
+
+    r[0] = 2.0f;
+
+    for(unsigned i=1; i<count; i++){
+        sum -= (float)time[i-1]*time[i-1] + (float)time[size-i]*time[size-i];
+        if(i >= low && i <= high && sum != 0.0f) voiced = std::max(voiced, r[i] / sum);
+        r[i] = (sum - 2 * r[i]) / (size - i);
+    }
+
+    // normalize
+
+    sum = 0.0f;
+    for(unsigned i=1; i<count; i++){
+        sum += r[i];
+        if(sum != 0.0f) r[i] *= i / sum;
+    }
+
+    for(unsigned i=count; i<size; i++) r[i] = 2.0f;
+
+    return voiced;
+}
+
+template<class T>
+float correlation_to_mse(const T *left, const T *right, const float *c, unsigned max,
+        unsigned low, float energy, float *mse, unsigned size){
+
+    // convert to mse, reversing the order to go by lag.
+
+    float sum = energy, voiced = 0.0f;
+
+    for(unsigned i=0; i<max; i++){
+        
+        if(i+low <= max && sum != 0.0f) voiced = std::max(voiced, c[i] / sum);
+        
+        mse[max-i] = (sum - 2 * c[i]) / (max - i);
+        sum -= (float)left[i]*left[i] + (float)right[max-i-1]*right[max-i-1];
+    }
+
+    // normalize
+
+    mse[0] = 2.0f;
+    sum = 0.0f;
+    for(unsigned i=1; i<=max; i++){
+        sum += mse[i];
+        if(sum != 0.0f) mse[i] *= i / sum;
+    }
+
+    for(unsigned i=max+1; i<size; i++) mse[i] = 2.0f;
+
+    return voiced;
+}
+
+float parabola_bottom(float left, float mid, float right){
+
+    // y = ax^2 + bx with the middle point as origo.
+
+    float y0 = left - mid, y1 = right - mid;
+    float a = (y1 + y0) / 2;
+    float b = (y1 - y0) / 2;
+
+    float bottom = -b / (2*a);
+
+    return bottom > -1.0f && bottom < 1.0f ? bottom : 0.0f;
+}
+
+void Detector::reset(unsigned frameRate, float lower, float upper){
+
+    // keep the memory if nothing changes size.
+
+    if(lower > upper) std::swap(lower, upper);
+    bool same = frameRate == rate
+        && (unsigned)std::floor(frameRate / upper) == min
+        && (unsigned)std::ceil(frameRate / lower) == max;
+
+    if(!same) configure(frameRate, lower, upper);
+    reset();
+}
+
+void Detector::reset(){
+    
+    buffer.clear();
+    fed = 2*size;
+
+    autoLags.at = 0;
+    crossLags.at = 0;
+    
+    period = 0;
+    pitch = 0;
+    confidence = 0;
+    voiced = 0;
+    quiet = 1;
+    trust = 0;
+    
+    momentum.top = 0;
+    
+    for(float &i : nonorm) i = 0.0f;
+
+    for(auto &c : coarse) c.reset();
+
+    searched = 0;
+}
+
+void Detector::restart(){
+
+    // the buffer is kept, the next search starts over from it: the exhaustive
+    // one probes with autocorrelation and the coarse one decimates the
+    // whole buffer into a fresh coarse detector.
+
+    trust = 0;
+    autoLags.at = 0;
+    crossLags.at = 0;
+
+    for(float &i : nonorm) i = 0.0f;
+
+    coarse.clear();
+}
+
+View Detector::get(unsigned amount){
+
+    if(amount == 0) amount = period;
+    amount = std::min(amount, max);
+
+    return {buffer.data() + 2*size - delay(), amount};
+}
+
+View Detector::get2(unsigned amount){
+
+    if(amount == 0) amount = period;
+    amount = std::min(amount, max);
+    
+    return {buffer.data() + 2*size - delay() - amount, 2*amount};
+}
+
+int64_t Detector::position(){
+    return (int64_t)fed - 2*size - delay();
+}
+
+unsigned Detector::delay(){
+    if(lookahead == 0) return size;
+    return std::min(size, std::max(max, lookahead));
+}
+
+float Detector::get_power(){
+    return power;
+}
+
+unsigned Detector::get_rate() const {
+    return rate;
+}
+
+std::vector<float> Detector::get_mse(){
+    if(decimation > 1 && !coarse.empty()) return coarse[0].get_mse();
+    return momentum.mse;
+}
+
+void Detector::setup_coarse(){
+
+    coarse.assign(1, Detector(rate / decimation, lowerBound, upperBound));
+
+    // windowed sinc low-pass with the cutoff a bit below the new nyquist.
+    // the symmetric blackman-harris window of 2c+1 taps is the periodic one of 2c.
+
+    unsigned c = 4 * decimation;
+    const float *window = math::window(math::Window::blackman_harris, 2*c).data;
+    double cutoff = 0.45 / decimation;
+
+    antialias.resize(2*c + 1);
+
+    double total = 0.0;
+    for(unsigned j=0; j<=2*c; j++){
+        double t = 2.0 * cutoff * ((double)j - c);
+        double sinc = t == 0.0 ? 1.0 : std::sin(PI * t) / (PI * t);
+        antialias[j] = sinc * window[j % (2*c)];
+        total += antialias[j];
+    }
+    for(float &h : antialias) h /= total;
+
+    decimated.reserve(2*size / decimation + 1);
+
+    // start from the whole buffer, so the decimation can be changed on the fly.
+    decimate(fed - 2*size);
+    coarse[0].feed(decimated);
+}
+
+void Detector::decimate(uint64_t from){
+
+    // the output for the absolute index p (a multiple of decimation)
+    // is made of x[p - taps + 1 .. p].
+
+    const float *history = buffer.data();
+    const uint64_t begin = fed - 2*size;
+    const unsigned taps = antialias.size();
+
+    uint64_t p = std::max(from, begin + taps - 1);
+    p = (p + decimation - 1) / decimation * decimation;
+
+    decimated.clear();
+    for(; p < fed; p += decimation){
+        const float *x = history + (p - begin) - (taps - 1);
+        float y = 0.0f;
+        for(unsigned j=0; j<taps; j++) y += antialias[j] * x[j];
+        decimated.push_back(y);
+    }
+}
+
+void Detector::feed_coarse(unsigned n){
+
+    if(coarse.empty() || antialias.size() != 8*decimation + 1) setup_coarse();
+
+    Detector &c = coarse[0];
+
+    c.peakWindowMax = peakWindowMax;
+    c.trustLimit = trustLimit;
+    c.minCutoff = minCutoff;
+    c.voicedThreshold = voicedThreshold;
+    c.quietThreshold = quietThreshold;
+    c.momentumDecay = momentumDecay;
+    c.lookahead = delay() / decimation;
+
+    decimate(fed - n);
+    c.feed(decimated);
+
+    if(quiet || !c.voiced){
+        voiced = 0;
+        confidence = quiet ? 1.0f : c.confidence;
+        trust = 0;
+        return;
+    }
+
+    voiced = 1;
+    confidence = c.confidence;
+    trust++;
+
+    // the coarse period in full rate lags.
+    float guess = c.real_period() * decimation;
+
+    if(!refine){
+        period = std::min(max, std::max(min, (unsigned)std::lround(guess)));
+        pitch = rate / guess;
+        return;
+    }
+
+    // refine with the mse of the latest window at the full rate. scratch[i]
+    // holds the lag from - 1 + i, so the neighbours of every lag are there.
+
+    const float *history = buffer.data();
+
+    unsigned from = std::max((float)min, guess - 2*decimation);
+    unsigned to = std::min((float)max, guess + 2*decimation);
+    from = std::max(from, 2u);
+    to = std::max(to, from);
+
+    const float *w = history + size;
+    for(unsigned lag=from-1; lag<=to+1; lag++){
+        scratch[lag - from + 1] = math::squared_distance(w, w + lag, size - lag) / (size - lag);
+    }
+
+    unsigned best = from;
+    for(unsigned lag=from; lag<=to; lag++){
+        if(scratch[lag - from + 1] < scratch[best - from + 1]) best = lag;
+    }
+
+    period = best;
+    pitch = (float)rate / period;
+
+    if(period + 1 <= max){
+
+        // parabolic interpolation as in feed.
+
+        const float *y = scratch.data() + (best - from);
+        pitch = (float)rate / (period + parabola_bottom(y[0], y[1], y[2]));
+    }
+}
+
+IntegerDetector::IntegerDetector(unsigned frameRate, float lower, float upper) :
+    peakWindowMax(5),
+    trustLimit(5),
+    minCutoff(0.25f),
+    voicedThreshold(0.3f),
+    quietThreshold(5e-5f),
+    momentumDecay(0.35f)
+{
+    configure(frameRate, lower, upper);
+    reset();
+}
+
+void IntegerDetector::configure(unsigned frameRate, float lower, float upper){
+
+    if(lower > upper) std::swap(lower, upper);
+
+    rate = frameRate;
+    min = std::floor(rate / upper);
+    max = std::ceil(rate / lower);
+    size = 2 * max;
+
+    storage.assign(4*size, 0);
+    momentum.mse.assign(size, 0.0f);
+    one.mse.assign(size, 0.0f);
+    two.mse.assign(size, 0.0f);
+    nonorm.assign(size, 0.0f);
+    scratch.assign(size, 0.0f);
+}
+
+void IntegerDetector::reset(unsigned frameRate, float lower, float upper){
+
+    if(lower > upper) std::swap(lower, upper);
+    bool same = frameRate == rate
+        && (unsigned)std::floor(frameRate / upper) == min
+        && (unsigned)std::ceil(frameRate / lower) == max;
+
+    if(!same) configure(frameRate, lower, upper);
+    reset();
+}
+
+void IntegerDetector::reset(){
+
+    std::fill(storage.begin(), storage.end(), 0);
+    head = 0;
+
+    period = 0;
+    pitch = 0;
+    confidence = 0;
+    voiced = 0;
+    quiet = 1;
+    trust = 0;
+
+    momentum.top = 0;
+    for(float &i : nonorm) i = 0.0f;
+}
+
+float IntegerDetector::real_period(){
+    if(pitch == 0.0f) return 0.0f;
+    return rate / pitch;
+}
+
+void IntegerDetector::feed(const std::vector<int16_t> &data){
+    feed(data.data(), data.size());
+}
+
+void IntegerDetector::normalize(const std::vector<float> &from, std::vector<float> &to){
+
+    float avg = 0.0f;
+    for(unsigned i=min; i<max; i++) avg += from[i];
+    avg /= (max-min);
+
+    if(avg > 1e-18){
+        float iavg = 1.0f / avg;
+        for(unsigned i=0; i<size; i++) to[i] = from[i] * iavg;
+    } else {
+        for(unsigned i=0; i<size; i++) to[i] = 2.0f;
+    }
+}
+
+void IntegerDetector::apply_momentum(const Info &x){
+
+    float newWeight = x.voiced * power;
+    float oldWeight = std::pow(momentumDecay, (float)x.move / size);
+
+    for(unsigned i=0; i<size; i++){
+        nonorm[i] = newWeight * x.mse[i] + oldWeight * nonorm[i];
+    }
+
+    momentum.voiced = x.voiced;
+}
+
+void IntegerDetector::feed(const int16_t *data, unsigned n, unsigned stride){
+
+    // see Detector::feed for the comments, this is its default path.
+
+    mirror_push(storage.data(), 2*size, head, data, n, stride);
+
+    const int16_t *history = storage.data() + head;
+    const unsigned at = size;
+
+    // the variance in exact integers, then on the float scale.
+    {
+        int64_t sum = 0, squares = math::dot(history + at, history + at, max);
+        for(unsigned i=0; i<max; i++) sum += history[at + i];
+
+        power = ((double)squares - (double)sum * sum / max) / max / (1u << 30);
+
+        quiet = power < quietThreshold;
+    }
+
+    if(quiet){
+
+        voiced = 0;
+        confidence = 1;
+        trust = 0;
+
+        float oldWeight = std::pow(momentumDecay, (float)n / size);
+
+        for(float &i : nonorm) i *= oldWeight;
+
+        return;
+    }
+
+    one.voiced = two.voiced = 0.0f;
+    one.move = n / 2;
+    two.move = n - one.move;
+
+    if(trust > trustLimit){
+
+        const int16_t *left1 = history + at - two.move - max, *right1 = history + at - two.move;
+        const int16_t *left2 = history + at - max, *right2 = history + at;
+
+        // scratch[i] is the correlation at lag max - i, like math::correlation gives.
+        auto correlate = [&](const int16_t *left, const int16_t *right) -> float {
+            for(unsigned i=0; i<max; i++) scratch[i] = math::dot(left + i, right, max - i);
+            return math::dot(left, left, max) + math::dot(right, right, max);
+        };
+
+        float energy1 = correlate(left1, right1);
+        one.voiced = correlation_to_mse(left1, right1, scratch.data(), max, min, energy1,
+                one.mse.data(), size);
+
+        float energy2 = correlate(left2, right2);
+        two.voiced = correlation_to_mse(left2, right2, scratch.data(), max, min, energy2,
+                two.mse.data(), size);
+    }
+    else {
+
+        const int16_t *onev = history + size - two.move, *twov = history + size;
+
+        // the lags after the peak window of max aren't looked at.
+        unsigned count = std::min(size, max + std::min(min/2, peakWindowMax) + 1);
+
+        for(unsigned i=0; i<count; i++){
+            one.mse[i] = math::dot(onev, onev + i, size - i);
+            two.mse[i] = math::dot(twov, twov + i, size - i);
+        }
+
+        float energy1 = one.mse[0], energy2 = two.mse[0];
+
+        one.voiced = autocorrelation_to_mse(onev, one.mse.data(), size, count, min, max, energy1);
+        two.voiced = autocorrelation_to_mse(twov, two.mse.data(), size, count, min, max, energy2);
+    }
+
+    normalize(one.mse, one.mse);
+    normalize(two.mse, two.mse);
+
+    apply_momentum(one);
+    apply_momentum(two);
+    normalize(nonorm, momentum.mse);
+
+    unsigned window = std::min(min/2, peakWindowMax);
+    momentum.top = find_peak(momentum.mse.data(), size, min, max, window, minCutoff, momentum.value);
+
+    const Info &best = momentum;
+
+    if(best.voiced > voicedThreshold){
+
+        confidence = 1.0f - best.value;
+
+        voiced = 1;
+        period = best.top;
+
+        pitch = (float)rate / period;
+        if(period > 1 && period + 1 <= max){
+            float bottom = parabola_bottom(best.mse[period-1], best.mse[period], best.mse[period+1]);
+            pitch = (float)rate / (period + bottom);
+        }
+
+        trust++;
+
+    } else {
+
+        confidence = 1.0f - best.voiced;
+        voiced = 0;
+        trust = 0;
+    }
+}
+
+DetectorBank::DetectorBank(unsigned lanes_, unsigned frameRate, float lower, float upper) :
+    lanes(lanes_),
+    peakWindowMax(5),
+    minCutoff(0.25f),
+    voicedThreshold(0.3f),
+    quietThreshold(5e-5f),
+    momentumDecay(0.35f),
+    rate(frameRate)
+{
+    if(lower > upper) std::swap(lower, upper);
+
+    min = std::floor(rate / upper);
+    max = std::ceil(rate / lower);
+
+    size = 2 * max;
+    buffer.resize(2 * size * lanes);
+
+    one.resize(size * lanes);
+    two.resize(size * lanes);
+    nonorm.resize(size * lanes);
+    momentum.resize(size * lanes);
+
+    re.resize(math::autocorrelation_size(size) * lanes);
+    im.resize(re.size());
+
+    for(auto v : {&power, &sum, &voiced1, &voiced2, &value, &lowest}) v->resize(lanes);
+    top.resize(lanes);
+    done.resize(lanes);
+
+    period.resize(lanes);
+    pitch.resize(lanes);
+    confidence.resize(lanes);
+    voiced.resize(lanes);
+    quiet.resize(lanes);
+
+    reset();
+}
+
+void DetectorBank::reset(){
+
+    buffer.clear();
+    std::fill(nonorm.begin(), nonorm.end(), 0.0f);
+
+    std::fill(period.begin(), period.end(), 0);
+    std::fill(pitch.begin(), pitch.end(), 0.0f);
+    std::fill(confidence.begin(), confidence.end(), 0.0f);
+    std::fill(voiced.begin(), voiced.end(), 0);
+    std::fill(quiet.begin(), quiet.end(), 1);
+}
+
+const std::pair<unsigned, bool> RealtimeDetector::degradation[] = {{1, 1}, {4, 1}, {4, 0}, {8, 0}};
+
+RealtimeDetector::RealtimeDetector(unsigned frameRate, unsigned hop_, unsigned lookahead,
+        float lower, float upper) :
+    detector(frameRate, lower, upper),
+    budget(0.5e6f * hop_ / frameRate),
+    recoverAfter(32),
+    rate(frameRate),
+    hop(hop_),
+    calm(0)
+{
+    detector.lookahead = lookahead;
+    pending.reserve(hop);
+    reset();
+}
+
+void RealtimeDetector::reset(){
+
+    detector.reset();
+    detector.decimation = degradation[0].first;
+    detector.refine = degradation[0].second;
+
+    pending.clear();
+
+    hops = misses = 0;
+    lastMicros = maxMicros = 0;
+    totalMicros = 0;
+    level = calm = 0;
+}
+
+void RealtimeDetector::push(const float *data, unsigned n, std::vector<Estimate> &out){
+
+    while(n){
+
+        unsigned take = std::min(n, hop - (unsigned)pending.size());
+        pending.insert(pending.end(), data, data + take);
+        data += take;
+        n -= take;
+
+        if(pending.size() < hop) break;
+
+        auto start = std::chrono::steady_clock::now();
+        detector.feed(pending);
+        auto end = std::chrono::steady_clock::now();
+
+        pending.clear();
+
+        lastMicros = std::chrono::duration<float, std::micro>(end - start).count();
+        maxMicros = std::max(maxMicros, lastMicros);
+        totalMicros += lastMicros;
+        hops++;
+
+        // degrade right away, recover slowly.
+
+        if(budget > 0.0f){
+
+            if(lastMicros > budget){
+                misses++;
+                calm = 0;
+                if(level + 1 < levels) level++;
+            }
+            else if(lastMicros < 0.5f * budget && level > 0 && ++calm >= recoverAfter){
+                calm = 0;
+                level--;
+            }
+
+            detector.decimation = degradation[level].first;
+            detector.refine = degradation[level].second;
+        }
+
+        int64_t sample = detector.position();
+        if(sample < 0) continue;
+
+        out.push_back({(uint64_t)sample, detector.pitch, detector.confidence, detector.voiced});
+    }
+}
+
+unsigned RealtimeDetector::latency(){
+    // the input is ahead of the latest estimate by the lookahead.
+    int64_t ahead = (int64_t)hops * hop - detector.position();
+    return ahead + hop - 1;
+}
+
+float RealtimeDetector::latency_ms(){
+    float compute = hops ? totalMicros / hops / 1000 : 0.0f;
+    return 1000.0f * latency() / rate + compute;
+}
+
+Prescan::Prescan(unsigned block_) :
+    block(block_),
+    pad(4096),
+    enter(5e-5f),
+    exit(1.25e-5f),
+    floorQuantile(0.1f),
+    enterOverFloor(0.0f),
+    exitOverFloor(0.0f)
+{}
+
+std::vector<Region> Prescan::scan(const std::vector<float> &waves){
+    return scan(waves.data(), waves.size());
+}
+
+std::vector<Region> Prescan::scan(const float *waves, unsigned n){
+    clear();
+    append(waves, n);
+    return finish();
+}
+
+void Prescan::clear(){
+    envelope.clear();
+    appended = 0;
+}
+
+void Prescan::append(const float *waves, unsigned n){
+
+    assert(appended % block == 0);
+
+    for(unsigned from=0; from<n; from+=block){
+        unsigned count = std::min(block, n - from);
+        float sum, squares;
+        math::sum_and_squares(waves + from, count, sum, squares);
+        float mean = sum / count;
+        envelope.push_back(std::max(0.0f, squares / count - mean * mean));
+    }
+
+    appended += n;
+}
+
+std::vector<Region> Prescan::finish(){
+
+    const uint64_t n = appended;
+    const unsigned blocks = envelope.size();
+
+    noiseFloor = 0.0f;
+    if(blocks && (enterOverFloor > 0.0f || exitOverFloor > 0.0f)){
+        sorted = envelope;
+        auto at = sorted.begin() + std::min<unsigned>(blocks - 1, floorQuantile * blocks);
+        std::nth_element(sorted.begin(), at, sorted.end());
+        noiseFloor = *at;
+    }
+
+    const float high = std::max(enter, enterOverFloor * noiseFloor);
+    const float low = std::max(exit, exitOverFloor * noiseFloor);
+
+    // hysteresis
+
+    std::vector<Region> regions;
+    bool active = 0;
+
+    for(unsigned b=0; b<blocks; b++){
+
+        if(!active && envelope[b] > high){
+            active = 1;
+            regions.push_back({(uint64_t)b * block, 0});
+        }
+        else if(active && envelope[b] < low){
+            active = 0;
+            regions.back().end = (uint64_t)b * block;
+        }
+    }
+    if(active) regions.back().end = n;
+
+    // pad & merge
+
+    std::vector<Region> merged;
+    uint64_t covered = 0;
+
+    for(auto r : regions){
+
+        r.begin = r.begin > pad ? r.begin - pad : 0;
+        r.end = std::min(r.end + pad, n);
+
+        if(!merged.empty() && r.begin <= merged.back().end){
+            merged.back().end = std::max(merged.back().end, r.end);
+        } else {
+            merged.push_back(r);
+        }
+    }
+
+    for(auto &r : merged) covered += r.end - r.begin;
+    skipped = n ? 1.0f - (float)covered / n : 0.0f;
+
+    return merged;
+}
+
+SegmentedDetector::SegmentedDetector(const Detector &prototype_, unsigned hop_) :
+    prototype(prototype_),
+    threads(0),
+    segment(10 * prototype_.get_rate()),
+    warmup(8 * prototype_.size),
+    hop(hop_)
+{}
+
+std::vector<Estimate> SegmentedDetector::track(const std::vector<float> &waves){
+    return track(waves.data(), waves.size());
+}
+
+void SegmentedDetector::detect(const float *waves, unsigned begin, unsigned first, unsigned last,
+        std::vector<Estimate> &out, std::vector<uint8_t> &valid){
+
+    Detector detector = prototype;
+    detector.reset();
+
+    std::vector<float> chunk(hop);
+
+    for(unsigned h=begin; h<last; h++){
+
+        std::copy(waves + (uint64_t)h * hop, waves + (uint64_t)(h+1) * hop, chunk.begin());
+        detector.feed(chunk);
+
+        // the positions of the detector count from the hop begin.
+        int64_t sample = detector.position() + (int64_t)begin * hop;
+        if(h < first || sample < (int64_t)begin * hop) continue;
+
+        out[h] = {(uint64_t)sample, detector.pitch, detector.confidence, detector.voiced};
+        valid[h] = 1;
+    }
+}
+
+std::vector<Estimate> SegmentedDetector::track(const float *waves, unsigned n){
+
+    const unsigned hops = n / hop;
+    if(hops == 0) return {};
+
+    unsigned workers = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+
+    unsigned length = segment ? std::max(1u, segment / hop) : hops;
+    unsigned segments = (hops + length - 1) / length;
+    unsigned warm = (std::max(warmup, 2 * prototype.size) + hop - 1) / hop;
+
+    workers = std::min(workers, segments);
+
+    std::vector<Estimate> out(hops);
+    std::vector<uint8_t> valid(hops, 0);
+
+    // the workers take the segments in order. Each segment is written by one
+    // worker only, so the order they finish in doesn't matter.
+
+    std::atomic<unsigned> next(0);
+
+    auto work = [&]{
+        for(unsigned s; (s = next++) < segments;){
+            unsigned first = s * length, last = std::min(hops, first + length);
+            unsigned begin = first > warm ? first - warm : 0;
+            detect(waves, begin, first, last, out, valid);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned w=1; w<workers; w++) pool.emplace_back(work);
+    work();
+    for(auto &thread : pool) thread.join();
+
+    // drop the hops before the detector had a position.
+
+    std::vector<Estimate> track;
+    track.reserve(hops);
+    for(unsigned h=0; h<hops; h++) if(valid[h]) track.push_back(out[h]);
+
+    return track;
+}
+
+Tracker::Tracker(unsigned frameRate, unsigned hop_, float lower, float upper) :
+    candidates(5),
+    threads(0),
+    peakWindowMax(5),
+    minCutoff(0.25f),
+    voicedThreshold(0.3f),
+    quietThreshold(5e-5f),
+    voicingCost(1.0f),
+    octaveCost(0.35f),
+    transitionCost(0.15f),
+    rate(frameRate),
+    hop(hop_)
+{
+    if(lower > upper) std::swap(lower, upper);
+
+    min = std::floor(rate / upper);
+    max = std::ceil(rate / lower);
+
+    size = 2 * max;
+}
+
+void Tracker::analyze(const float *waves, unsigned n, unsigned first, unsigned last,
+        std::vector<Frame> &frames, std::vector<Candidate> &found){
+
+    std::vector<float> window(size), mse(size);
+    std::vector<std::complex<float> > spectrum(math::autocorrelation_size(size));
+
+    const unsigned K = std::max(candidates, 1u);
+    const unsigned peak = std::min(min/2, peakWindowMax);
+
+    for(unsigned t=first; t<last; t++){
+
+        Frame &frame = frames[t];
+        Candidate *best = found.data() + (size_t)t * K;
+
+        frame.voicing = 0.0f;
+        frame.count = 0;
+
+        // the frame, zero padded at the ends of the file.
+
+        int64_t start = (int64_t)t * hop - max;
+        for(unsigned i=0; i<size; i++){
+            int64_t j = start + i;
+            window[i] = j >= 0 && j < n ? waves[j] : 0.0f;
+        }
+
+        float avg = 0.0f, energy = 0.0f, power = 0.0f;
+        for(float x : window) avg += x;
+        avg /= size;
+        for(float x : window) energy += x * x;
+        for(float x : window) power += (x - avg) * (x - avg);
+        power /= size;
+
+        if(power < quietThreshold) continue;
+
+        math::autocorrelation(window.data(), size, nullptr, 0, mse.data(), nullptr, spectrum.data());
+        frame.voicing = autocorrelation_to_mse(window.data(), mse.data(), size, size, min, max, energy);
+
+        // normalize like the detector, so the values are comparable to its cutoffs.
+
+        float scale = 0.0f;
+        for(unsigned i=min; i<max; i++) scale += mse[i];
+        if(scale <= 1e-18f) continue;
+        scale = (max - min) / scale;
+        for(float &x : mse) x *= scale;
+
+        // the deepest local minima below 1, sorted by value.
+
+        for(unsigned i=std::max(min, peak); i<=max && i+peak+1<size; i++){
+
+            if(!(mse[i] < 1.0f)) continue;
+            if(frame.count == K && !(mse[i] < best[K-1].value)) continue;
+
+            bool minimum = 1;
+            for(unsigned j=i-peak; j<=i+peak; j++) minimum &= !(mse[j] < mse[i]);
+            if(!minimum) continue;
+
+            // parabolic interpolation, see Detector::feed.
+
+            float period = i;
+            if(i > 1) period += parabola_bottom(mse[i-1], mse[i], mse[i+1]);
+
+            unsigned k = std::min(frame.count, K-1);
+            while(k > 0 && best[k-1].value > mse[i]){
+                best[k] = best[k-1];
+                k--;
+            }
+            best[k] = {period, mse[i]};
+            frame.count = std::min(frame.count + 1, K);
+
+            // longer lags would be multiples of this period, as in find_peak.
+            if(mse[i] < minCutoff) break;
+        }
+    }
+}
+
+std::vector<Estimate> Tracker::track(const std::vector<float> &waves){
+    return track(waves.data(), waves.size());
+}
+
+std::vector<Estimate> Tracker::track(const float *waves, unsigned n){
+
+    const unsigned K = std::max(candidates, 1u);
+
+    const unsigned T = (n + hop - 1) / hop;
+    if(T == 0) return {};
+
+    std::vector<Frame> frames(T);
+    std::vector<Candidate> found((size_t)T * K);
+
+    // candidates in parallel. Every thread takes a contiguous block of
+    // frames, so the result doesn't depend on the number of threads.
+
+    unsigned workers = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    workers = std::min(workers, T);
+
+    std::vector<std::thread> pool;
+    for(unsigned w=1; w<workers; w++){
+        pool.emplace_back([&, w]{
+            analyze(waves, n, (uint64_t)T * w / workers, (uint64_t)T * (w+1) / workers, frames, found);
+        });
+    }
+    analyze(waves, n, 0, T / workers, frames, found);
+    for(auto &thread : pool) thread.join();
+
+    // viterbi. state K is unvoiced, k < count are the candidates.
+
+    const unsigned S = K + 1;
+    std::vector<float> cost(S), next(S);
+    std::vector<unsigned> from((size_t)T * S);
+
+    auto local = [&](unsigned t, unsigned k) -> float {
+        float v = frames[t].voicing;
+        if(k == K) return voicingCost * std::max(0.0f, v - voicedThreshold);
+        const Candidate *c = found.data() + (size_t)t*K;
+        return c[k].value - c[0].value + voicingCost * std::max(0.0f, voicedThreshold - v);
+    };
+
+    auto transition = [&](unsigned t, unsigned a, unsigned b) -> float {
+        if(a == K && b == K) return 0.0f;
+        if(a == K || b == K) return transitionCost;
+        float p = found[(size_t)(t-1)*K + a].period, q = found[(size_t)t*K + b].period;
+        return octaveCost * std::abs(std::log2(q / p));
+    };
+
+    const float inf = std::numeric_limits<float>::infinity();
+
+    for(unsigned k=0; k<S; k++) cost[k] = k < frames[0].count || k == K ? local(0, k) : inf;
+
+    for(unsigned t=1; t<T; t++){
+        for(unsigned b=0; b<S; b++){
+
+            next[b] = inf;
+            from[(size_t)t*S + b] = K;
+            if(b < K && b >= frames[t].count) continue;
+
+            for(unsigned a=0; a<S; a++){
+                if(cost[a] == inf) continue;
+                float c = cost[a] + transition(t, a, b);
+                if(c < next[b]){
+                    next[b] = c;
+                    from[(size_t)t*S + b] = a;
+                }
+            }
+            next[b] += local(t, b);
+        }
+        cost.swap(next);
+    }
+
+    // backtrack
+
+    std::vector<Estimate> track(T);
+
+    unsigned state = std::min_element(cost.begin(), cost.end()) - cost.begin();
+    for(unsigned t=T; t-->0;){
+
+        Estimate &e = track[t];
+        e.sample = (uint64_t)t * hop;
+
+        if(state == K){
+            e.voiced = 0;
+            e.pitch = 0.0f;
+            e.confidence = 1.0f - frames[t].voicing;
+        } else {
+            const Candidate &c = found[(size_t)t*K + state];
+            e.voiced = 1;
+            e.pitch = rate / c.period;
+            e.confidence = 1.0f - c.value;
+        }
+
+        state = from[(size_t)t*S + state];
+    }
+
+    return track;
+}
+
+void DetectorBank::feed(const std::vector<float> &data){
+    feed(data.data(), data.size() / lanes);
+}
+
+void DetectorBank::feed(const float *data, unsigned n){
+
+    const unsigned L = lanes;
+
+    buffer.push(data, n * L);
+
+    const float *history = buffer.data();
+
+    // check if the signals are quiet
+
+    {
+        const float *x = history + size * L;
+
+        std::fill(sum.begin(), sum.end(), 0.0f);
+        std::fill(power.begin(), power.end(), 0.0f);
+
+        for(unsigned i=0; i<max; i++)
+            for(unsigned k=0; k<L; k++) sum[k] += x[i*L + k];
+        for(unsigned k=0; k<L; k++) sum[k] /= max;
+
+        for(unsigned i=0; i<max; i++)
+            for(unsigned k=0; k<L; k++){
+                float d = x[i*L + k] - sum[k];
+                power[k] += d * d;
+            }
+
+        for(unsigned k=0; k<L; k++){
+            power[k] /= max;
+            quiet[k] = power[k] < quietThreshold;
+        }
+    }
+
+    // the autocorrelations of both windows of every stream with one batched fft.
+    // same packing as math::autocorrelation, one window real and the other imaginary.
+
+    const unsigned moveOne = n / 2, moveTwo = n - moveOne;
+    const float *onev = history + (size - moveTwo) * L, *twov = history + size * L;
+
+    const unsigned z = re.size() / L / 2;
+
+    std::copy(onev, onev + size * L, re.begin());
+    std::copy(twov, twov + size * L, im.begin());
+    std::fill(re.begin() + size * L, re.end(), 0.0f);
+    std::fill(im.begin() + size * L, im.end(), 0.0f);
+
+    math::batched_fft(re.data(), im.data(), 2*z, L);
+
+    for(unsigned i=0; i<=z; i++){
+
+        unsigned j = i == 0 ? 0 : 2*z-i;
+        float *ri = re.data() + i*L, *ii = im.data() + i*L;
+        float *rj = re.data() + j*L, *ij = im.data() + j*L;
+
+        for(unsigned k=0; k<L; k++){
+            float xr = ri[k]+rj[k], xi = ii[k]-ij[k];
+            float yr = ri[k]-rj[k], yi = ii[k]+ij[k];
+            ri[k] = rj[k] = (xr*xr + xi*xi) * 0.25f;
+            ii[k] = ij[k] = (yr*yr + yi*yi) * 0.25f;
+        }
+    }
+
+    math::batched_fft(re.data(), im.data(), 2*z, L, 1);
+
+    std::copy(re.begin(), re.begin() + size * L, one.begin());
+    std::copy(im.begin(), im.begin() + size * L, two.begin());
+
+    // convert to mse and normalize by the cumulative average, see Detector::feed.
+
+    auto process_mse = [&](const float *time, float *mse, float *vo) -> void {
+
+        std::fill(sum.begin(), sum.end(), 0.0f);
+        for(unsigned i=0; i<size; i++)
+            for(unsigned k=0; k<L; k++) sum[k] += time[i*L + k] * time[i*L + k];
+
+        for(unsigned k=0; k<L; k++){
+            sum[k] *= 2;
+            mse[k] = 2.0f;
+            vo[k] = 0.0f;
+        }
+
+        for(unsigned i=1; i<size; i++){
+
+            const float *a = time + (i-1)*L, *b = time + (size-i)*L;
+            float *m = mse + i*L;
+            bool probe = i >= min && i <= max;
+
+            for(unsigned k=0; k<L; k++){
+                sum[k] -= a[k]*a[k] + b[k]*b[k];
+                float s = sum[k];
+                if(probe) vo[k] = std::max(vo[k], s != 0.0f ? m[k] / s : 0.0f);
+                m[k] = (s - 2 * m[k]) / (size - i);
+            }
+        }
+
+        std::fill(sum.begin(), sum.end(), 0.0f);
+        for(unsigned i=1; i<size; i++){
+            float *m = mse + i*L;
+            for(unsigned k=0; k<L; k++){
+                sum[k] += m[k];
+                m[k] = sum[k] != 0.0f ? m[k] * (i / sum[k]) : m[k];
+            }
+        }
+    };
+
+    process_mse(onev, one.data(), voiced1.data());
+    process_mse(twov, two.data(), voiced2.data());
+
+    // to may be the same as from.
+    auto normalize = [&](const float *from, float *to) -> void {
+
+        std::fill(sum.begin(), sum.end(), 0.0f);
+        for(unsigned i=min; i<max; i++)
+            for(unsigned k=0; k<L; k++) sum[k] += from[i*L + k];
+
+        for(unsigned k=0; k<L; k++){
+            float avg = sum[k] / (max-min);
+            sum[k] = avg > 1e-18 ? 1.0f / avg : 0.0f;
+        }
+
+        for(unsigned i=0; i<size; i++)
+            for(unsigned k=0; k<L; k++)
+                to[i*L + k] = sum[k] != 0.0f ? from[i*L + k] * sum[k] : 2.0f;
+    };
+
+    normalize(one.data(), one.data());
+    normalize(two.data(), two.data());
+
+    // quiet streams only decay the momentum.
+
+    auto apply_momentum = [&](const float *mse, const float *vo, unsigned move, float quietWeight){
+
+        float oldWeight = std::pow(momentumDecay, (float)move / size);
+
+        for(unsigned k=0; k<L; k++) sum[k] = vo[k] * power[k];
+
+        for(unsigned i=0; i<size; i++){
+            const float *m = mse + i*L;
+            float *o = nonorm.data() + i*L;
+            for(unsigned k=0; k<L; k++)
+                o[k] = quiet[k] ? quietWeight * o[k] : sum[k] * m[k] + oldWeight * o[k];
+        }
+    };
+
+    apply_momentum(one.data(), voiced1.data(), moveOne, std::pow(momentumDecay, (float)n / size));
+    apply_momentum(two.data(), voiced2.data(), moveTwo, 1.0f);
+    normalize(nonorm.data(), momentum.data());
+
+    // peak search, see find_peak. lanes that found a peak below the
+    // cutoff are done and keep it.
+
+    {
+        const float *mse = momentum.data();
+        unsigned window = std::min(min/2, peakWindowMax);
+
+        std::fill(value.begin(), value.end(), 1.0f);
+        std::fill(top.begin(), top.end(), 0);
+        for(unsigned k=0; k<L; k++) done[k] = quiet[k];
+
+        for(unsigned i=std::max(min, window); i<=max && i+window+1<size; i++){
+
+            const float *m = mse + i*L;
+
+            // like in find_peak, the neighbourhood is checked only
+            // if some lane might take the lag.
+            unsigned candidates = 0;
+            for(unsigned k=0; k<L; k++) candidates += !done[k] && m[k] < value[k];
+            if(!candidates) continue;
+
+            std::copy(m, m + L, lowest.begin());
+            for(unsigned j=i-window; j<=i+window; j++)
+                for(unsigned k=0; k<L; k++) lowest[k] = std::min(lowest[k], mse[j*L + k]);
+
+            unsigned left = 0;
+            for(unsigned k=0; k<L; k++){
+                bool take = !done[k] && m[k] < value[k] && !(lowest[k] < m[k]);
+                value[k] = take ? m[k] : value[k];
+                top[k] = take ? i : top[k];
+                done[k] = done[k] | (take && m[k] < minCutoff);
+                left += !done[k];
+            }
+
+            if(!left) break;
+        }
+    }
+
+    // classify.
+
+    for(unsigned k=0; k<L; k++){
+
+        if(quiet[k]){
+            voiced[k] = 0;
+            confidence[k] = 1;
+            continue;
+        }
+
+        float vo = voiced2[k];
+
+        if(vo > voicedThreshold){
+
+            confidence[k] = 1.0f - value[k];
+            voiced[k] = 1;
+            period[k] = top[k];
+
+            unsigned p = period[k];
+            pitch[k] = (float)rate / p;
+
+            if(p > 1 && p + 1 <= max){
+
+                const float *m = momentum.data() + k;
+                pitch[k] = (float)rate / (p + parabola_bottom(m[(p-1)*L], m[p*L], m[(p+1)*L]));
+            }
+
+        } else {
+
+            confidence[k] = 1.0f - vo;
+            voiced[k] = 0;
+        }
+    }
+}
+
+}   // namespace change
+
+/*****************************************************************************/
+// harmonic grid //////////////////////////////////////////////////////////////
+/*****************************************************************************/
+
+// maps the values of the harmonics of a frame, in[j] for the harmonic j+1
+// at (j+1)*pitch, to a fixed grid of points at (i+1)*spacing Hz. The map is
+// linear and sparse: linear interpolation takes the 2 harmonics around a
+// point and sinc2 spreads each harmonic with a sinc^2 kernel, which is zero
+// from 3 harmonics away, so a point takes at most 6.
+//
+// build makes the taps for a pitch. A point is at a = (i+1)*spacing/pitch
+// in units of the pitch, and the kernel only needs sin(pi*a) as
+// sin(pi*(a - k)) = +-sin(pi*a) for whole k. Both maps are exact that way,
+// so there is no table of operators by pitch to build or round to. The
+// weights are stored tap by tap, so build and apply run across the points
+// and vectorize. Neither allocates after the first frame.
+
+class GridOperator {
+
+public:
+
+    enum Kind { linear, sinc2 };
+
+    GridOperator(Kind kind = linear, unsigned points = 100, float spacing = 60.0f);
+
+    // the taps for harmonics values at the given pitch.
+    // harmonics * pitch must reach the last grid point.
+    void build(float pitch, unsigned harmonics);
+
+    // out[0 .. points) from in[0 .. harmonics). root takes sqrt(|in|) first,
+    // which turns energies into amplitudes.
+    void apply(const float *in, float *out, bool root = 0);
+
+    unsigned points;
+
+private:
+
+    static const unsigned width = 6;
+
+    Kind kind;
+    float spacing;
+    unsigned harmonics, taps;
+
+    // tap t of point i is weight[t*points + i] for in[first[i] + t].
+    std::vector<int> first;
+    std::vector<float> weight;
+
+    // sin(pi*a)^2 / pi^2 and the offset of a from in[first[i]]. A point
+    // near a harmonic divides two small numbers, so these are doubles.
+    std::vector<double> sine, offset;
+
+    // in with width zeros on both sides.
+    std::vector<float> padded;
+};
+
+GridOperator::GridOperator(Kind kind_, unsigned points_, float spacing_) :
+    points(points_),
+    kind(kind_),
+    spacing(spacing_),
+    harmonics(0),
+    taps(kind_ == linear ? 2 : width),
+    first(points_, 0),
+    weight(points_ * width, 0.0f),
+    sine(points_, 0.0),
+    offset(points_, 0.0)
+{}
+
+void GridOperator::build(float pitch, unsigned harmonics_){
+
+    harmonics = harmonics_;
+
+    assert(harmonics*pitch >= points*spacing);
+
+    const double d = (double)spacing / pitch;
+
+    if(kind == linear){
+
+        // a is between the harmonics j and j+1, in[j-1] and in[j].
+        float *__restrict l = weight.data(), *__restrict r = l + points;
+
+        for(unsigned i=0; i<points; i++){
+
+            double a = (i+1)*d;
+            double j = std::ceil(a) - 1;
+
+            first[i] = (int)j - 1;
+            l[i] = j + 1 - a;
+            r[i] = a - j;
+        }
+        return;
+    }
+
+    // sin(pi*a) point by point with the recurrence
+    // sin((i+2)x) = 2cos(x) sin((i+1)x) - sin(ix).
+    const double c = 2 * std::cos(d*M_PI);
+    double s0 = 0.0, s1 = std::sin(d*M_PI);
+
+    for(unsigned i=0; i<points; i++){
+
+        double a = (i+1)*d;
+        double s = s1;
+
+        s1 = c*s1 - s0;
+        s0 = s;
+
+        // the harmonics in (a-3, a+3), a is in (2, 3] from the first.
+        first[i] = (int)std::ceil(a - 3) - 1;
+        offset[i] = a - first[i] - 1;
+        sine[i] = s*s / (M_PI*M_PI);
+    }
+
+    for(unsigned t=0; t<width; t++){
+
+        float *__restrict w = weight.data() + t*points;
+
+        for(unsigned i=0; i<points; i++){
+            double x = offset[i] - t;
+            double y = sine[i] / std::max(x*x, 1e-20);
+            w[i] = x*x < 9.0 ? y : 0.0;
+        }
+    }
+
+    // sinc2(0) is the limit 1, a is on a harmonic.
+    for(unsigned i=0; i<points; i++){
+        int t = std::lrint(offset[i]);
+        if(std::abs(offset[i] - t) < 1e-5) weight[t*points + i] = 1.0f;
+    }
+}
+
+void GridOperator::apply(const float *in, float *out, bool root){
+
+    padded.assign(harmonics + 2*width, 0.0f);
+
+    float *x = padded.data() + width;
+    if(root) for(unsigned j=0; j<harmonics; j++) x[j] = std::sqrt(std::abs(in[j]));
+    else std::copy(in, in + harmonics, x);
+
+    std::fill(out, out + points, 0.0f);
+
+    for(unsigned t=0; t<taps; t++){
+
+        const float *__restrict w = weight.data() + t*points;
+        const float *__restrict y = x + t;
+        const int *__restrict f = first.data();
+
+        for(unsigned i=0; i<points; i++) out[i] += w[i] * y[f[i]];
+    }
+}
+
+/*****************************************************************************/
+// npy output /////////////////////////////////////////////////////////////////
+/*****************************************************************************/
+
+// writes a numpy .npy array row by row, so it loads with np.load(path,
+// mmap_mode='r') without parsing. The header has room for any row count,
+// which close patches in. Rows are gathered in a large buffer and written
+// in blocks.
+
+class NpyWriter {
+
+public:
+
+    NpyWriter() = default;
+    ~NpyWriter();
+
+    // descr is the numpy type, "<f4" or "|u1" for example.
+    // columns = 0 makes a 1d array.
+    bool open(std::string path, std::string descr, unsigned columns = 0);
+
+    // one row, columns values (one if columns = 0) of the type given in open.
+    bool write(const void *row);
+
+    // n rows one after another.
+    bool write(const void *rows, uint64_t n);
+
+    // the bytes of a row.
+    unsigned row_size(){ return rowSize; }
+
+    // writes the rest of the buffer and the final header.
+    bool close();
+
+    uint64_t rows(){ return count; }
+
+    // written so far, the header included.
+    uint64_t bytes(){ return headerSize + count * rowSize; }
+
+private:
+
+    static const unsigned headerSize = 128;
+    static const unsigned bufferSize = 1 << 20;
+
+    std::ofstream file;
+    std::string descr;
+    unsigned columns = 0, rowSize = 0;
+    uint64_t count = 0;
+    std::vector<char> buffer;
+
+    std::string header();
+    bool flush();
+};
+
+// s as a json string literal, quotes included.
+std::string json_string(const std::string &s);
+
+NpyWriter::~NpyWriter(){
+    if(file.is_open()) close();
+}
+
+bool NpyWriter::open(std::string path, std::string descr_, unsigned columns_){
+
+    if(file.is_open()) close();
+
+    descr = descr_;
+    columns = columns_;
+    count = 0;
+
+    unsigned itemSize = descr.size() > 2 ? std::atoi(descr.c_str() + 2) : 0;
+    if(itemSize == 0) return 0;
+    rowSize = itemSize * std::max(columns, 1u);
+
+    buffer.clear();
+    buffer.reserve(bufferSize + rowSize);
+
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if(!file) return 0;
+
+    std::string h = header();
+    file.write(h.data(), h.size());
+
+    return file.good();
+}
+
+std::string NpyWriter::header(){
+
+    // magic, version 1.0, little endian header length, the dict padded
+    // with spaces and ended with a newline to headerSize bytes.
+
+    std::string shape = "(" + std::to_string(count) + (columns ? ", " + std::to_string(columns) : ",") + ")";
+    std::string dict = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': " + shape + ", }";
+
+    unsigned length = headerSize - 10;
+    dict.resize(length - 1, ' ');
+    dict += '\n';
+
+    std::string h = "\x93NUMPY";
+    h += (char)1;
+    h += (char)0;
+    h += (char)(length & 0xff);
+    h += (char)(length >> 8);
+
+    return h + dict;
+}
+
+bool NpyWriter::write(const void *row){
+
+    if(!file.is_open()) return 0;
+
+    const char *c = (const char*)row;
+    buffer.insert(buffer.end(), c, c + rowSize);
+    count++;
+
+    if(buffer.size() >= bufferSize) return flush();
+    return 1;
+}
+
+bool NpyWriter::write(const void *rows, uint64_t n){
+
+    if(!file.is_open()) return 0;
+
+    const char *c = (const char*)rows;
+    buffer.insert(buffer.end(), c, c + n * rowSize);
+    count += n;
+
+    if(buffer.size() >= bufferSize) return flush();
+    return 1;
+}
+
+bool NpyWriter::flush(){
+    file.write(buffer.data(), buffer.size());
+    buffer.clear();
+    return file.good();
+}
+
+bool NpyWriter::close(){
+
+    if(!file.is_open()) return 0;
+
+    bool ok = flush();
+
+    std::string h = header();
+    file.seekp(0);
+    file.write(h.data(), h.size());
+
+    ok &= file.good();
+    file.close();
+
+    return ok;
+}
+
+std::string json_string(const std::string &s){
+
+    std::string r = "\"";
+
+    for(unsigned char c : s){
+        if(c == '"' || c == '\\'){
+            r += '\\';
+            r += c;
+        }
+        else if(c < 0x20){
+            char u[8];
+            std::snprintf(u, sizeof(u), "\\u%04x", c);
+            r += u;
+        }
+        else r += c;
+    }
+
+    return r + '"';
+}
+
+/*****************************************************************************/
+// csv output /////////////////////////////////////////////////////////////////
+/*****************************************************************************/
+
+// text written in big chunks: the bytes are collected in a buffer and
+// written once it is full, not per row or per file. format_row formats
+// floats with std::to_chars, the same digits iostreams give with the same
+// format and precision. It only touches its string, so the workers format
+// their rows in parallel and the writer just appends the text.
+
+class CsvWriter {
+
+public:
+
+    CsvWriter() = default;
+    ~CsvWriter();
+
+    // sync fsyncs the file on close.
+    bool open(std::string path, bool sync = 0);
+
+    // n values separated by commas and a newline, appended to text.
+    static void format_row(std::string &text, const float *values, unsigned n,
+            std::chars_format format = std::chars_format::fixed, int precision = 6);
+
+    // a failed write is sticky: the later writes are dropped and close
+    // returns 0, so an error mid-run isn't lost with the buffer.
+    bool write(const char *data, size_t n);
+    bool write(const std::string &text){ return write(text.data(), text.size()); }
+
+    // writes the rest of the buffer. 0 if any write failed.
+    bool close();
+
+    bool is_open(){ return fd >= 0; }
+
+    // written so far, the buffer included.
+    uint64_t bytes(){ return count; }
+
+    // the time spent in the write and fsync calls.
+    double seconds(){ return elapsed; }
+
+private:
+
+    static const unsigned bufferSize = 1 << 22;
+
+    int fd = -1;
+    bool sync = 0, failed = 0;
+    uint64_t count = 0;
+    double elapsed = 0.0;
+    std::vector<char> buffer;
+
+    bool flush();
+};
+
+CsvWriter::~CsvWriter(){
+    if(is_open()) close();
+}
+
+bool CsvWriter::open(std::string path, bool sync_){
+
+    if(is_open()) close();
+
+    sync = sync_;
+    failed = 0;
+    count = 0;
+    elapsed = 0.0;
+
+    buffer.clear();
+    buffer.reserve(bufferSize);
+
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    return fd >= 0;
+}
+
+void CsvWriter::format_row(std::string &text, const float *values, unsigned n,
+        std::chars_format format, int precision){
+
+    // room for the longest float in fixed notation, 39 digits and a sign,
+    // the decimals and the separator.
+    const unsigned room = 48 + precision;
+
+    size_t at = text.size();
+    text.resize(at + (size_t)n * room);
+
+    char *c = &text[at], *end = &text[0] + text.size();
+
+    for(unsigned i=0; i<n; i++){
+        c = std::to_chars(c, end, values[i], format, precision).ptr;
+        *c++ = i+1 < n ? ',' : '\n';
+    }
+
+    text.resize(c - &text[0]);
+}
+
+bool CsvWriter::write(const char *data, size_t n){
+
+    if(!is_open() || failed) return 0;
+
+    count += n;
+
+    if(buffer.size() + n > bufferSize && !flush()) return 0;
+    if(n >= bufferSize){
+        buffer.assign(data, data + n);
+        return flush();
+    }
+
+    buffer.insert(buffer.end(), data, data + n);
+    return 1;
+}
+
+bool CsvWriter::flush(){
+
+    auto begin = std::chrono::steady_clock::now();
+
+    const char *c = buffer.data();
+    size_t left = buffer.size();
+
+    while(left){
+        ssize_t done = ::write(fd, c, left);
+        if(done < 0 && errno == EINTR) continue;
+        if(done <= 0) break;
+        c += done;
+        left -= done;
+    }
+
+    buffer.clear();
+    elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    failed |= left != 0;
+    return !failed;
+}
+
+bool CsvWriter::close(){
+
+    if(!is_open()) return 0;
+
+    bool ok = flush();
+
+    auto begin = std::chrono::steady_clock::now();
+    if(sync) ok &= ::fsync(fd) == 0;
+    ok &= ::close(fd) == 0;
+    elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    fd = -1;
+
+    return ok && !failed;
+}
+
+/*****************************************************************************/
+// feature cache //////////////////////////////////////////////////////////////
+/*****************************************************************************/
+
+// 64 bit hash of n bytes. Not cryptographic, only for telling contents apart.
+uint64_t hash_bytes(const void *data, size_t n, uint64_t seed = 0);
+
+// the same hash of n bytes given a part at a time. Every part but the
+// last must be a multiple of 8 bytes.
+class Hasher {
+public:
+    Hasher(uint64_t seed, size_t n);
+    void add(const void *data, size_t n);
+    uint64_t digest();
+private:
+    uint64_t h, tail = 0;
+};
+
+// the features parse_to_csv takes from one file.
+struct FileFeatures {
+    std::string label;
+    std::vector<std::vector<float> > rows;
+    uint64_t samples = 0;
+    float skipped = 0.0f;
+    uint64_t candidates = 0, spectra = 0;
+};
+
+// the detector output for the hops of one file, one column per value.
+// hop is the index of the hop, its samples are [hop * step, (hop + 1) * step).
+// start marks the hops the detector was reset before (a new prescan region),
+// the detector buffer holds zeros before the first sample of that hop.
+struct PitchTrack {
+    uint64_t samples = 0;
+    float skipped = 0.0f;
+    std::vector<uint32_t> hop;
+    std::vector<float> pitch, confidence, power;
+    std::vector<uint16_t> period;
+    std::vector<uint8_t> voiced, start;
+
+    void clear();
+    unsigned size() const { return hop.size(); }
+};
+
+// the payloads the two are stored as. decode returns 0 if the payload is broken.
+void encode(const FileFeatures &features, std::vector<char> &payload);
+bool decode(const std::vector<char> &payload, FileFeatures &features);
+void encode(const PitchTrack &track, std::vector<char> &payload);
+bool decode(const std::vector<char> &payload, PitchTrack &track);
+
+// persistent store of byte payloads by key. The key should cover the file
+// contents and every parameter that changes the payload. The file is
+// append-only: records are only added, the last one of a key counts.
+// A record cut short (the program was stopped while appending) is dropped
+// when the store is opened.
+
+class RecordFile {
+
+public:
+
+    typedef std::pair<uint64_t, uint64_t> Key;
+
+    // loads the records and opens the file for appending.
+    bool open(std::string path);
+    bool close();
+    bool is_open() const { return file.is_open(); }
+
+    // nullptr if there is no record. Only sees the records loaded by open,
+    // so it is safe to call from multiple threads while storing.
+    const std::vector<char> *find(Key key) const;
+
+    // appends a record.
+    bool store(Key key, const std::vector<char> &payload);
+
+    unsigned size() const { return records.size(); }
+
+private:
+
+    static constexpr uint32_t magic = 0x31435046;   // "FPC1"
+
+    std::map<Key, std::vector<char> > records;
+    std::ofstream file;
+};
+
+uint64_t hash_bytes(const void *data, size_t n, uint64_t seed){
+    Hasher hasher(seed, n);
+    hasher.add(data, n);
+    return hasher.digest();
+}
+
+static constexpr uint64_t hashK1 = 0x9e3779b97f4a7c15ull, hashK2 = 0xbf58476d1ce4e5b9ull;
+
+Hasher::Hasher(uint64_t seed, size_t n) : h(seed ^ (n * hashK1)) {}
+
+void Hasher::add(const void *data, size_t n){
+
+    const uint8_t *c = (const uint8_t*)data;
+
+    auto mix = [&](uint64_t w){
+        w *= hashK2;
+        w ^= w >> 31;
+        h = (h ^ w) * hashK1;
+        h = h << 27 | h >> 37;
+    };
+
+    size_t i = 0;
+    for(; i+8<=n; i+=8){
+        uint64_t w;
+        std::memcpy(&w, c + i, 8);
+        mix(w);
+    }
+
+    // only the last part can have a tail, it is mixed in by digest.
+    for(unsigned j=0; i+j<n; j++) tail |= (uint64_t)c[i+j] << (8*j);
+}
+
+uint64_t Hasher::digest(){
+
+    uint64_t w = tail * hashK2;
+    w ^= w >> 31;
+    h = (h ^ w) * hashK1;
+    h = h << 27 | h >> 37;
+
+    // murmur3 finalizer.
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+
+    return h;
+}
+
+void PitchTrack::clear(){
+    samples = 0;
+    skipped = 0.0f;
+    hop.clear();
+    pitch.clear();
+    confidence.clear();
+    power.clear();
+    period.clear();
+    voiced.clear();
+    start.clear();
+}
+
+// little helpers for the payloads. put appends, take reads from the
+// front of the remaining bytes and fails if there aren't enough.
+
+struct PayloadWriter {
+    std::vector<char> &to;
+    void put(const void *from, size_t n){
+        to.insert(to.end(), (const char*)from, (const char*)from + n);
+    }
+    template<class T> void put(const T &x){ put(&x, sizeof(T)); }
+    template<class T> void column(const std::vector<T> &x){ put(x.data(), x.size() * sizeof(T)); }
+};
+
+struct PayloadReader {
+    const char *p, *end;
+    bool take(void *to, size_t n){
+        if((size_t)(end - p) < n) return 0;
+        std::memcpy(to, p, n);
+        p += n;
+        return 1;
+    }
+    template<class T> bool take(T &x){ return take(&x, sizeof(T)); }
+    template<class T> bool column(std::vector<T> &x, uint32_t n){
+        if((size_t)(end - p) < (size_t)n * sizeof(T)) return 0;
+        x.resize(n);
+        return take(x.data(), (size_t)n * sizeof(T));
+    }
+};
+
+void encode(const FileFeatures &f, std::vector<char> &payload){
+
+    // label size (u32), label, samples (u64), skipped (f32), candidates (u64),
+    // spectra (u64), rows (u32), columns (u32), rows x columns f32.
+
+    uint32_t labelSize = f.label.size(), rows = f.rows.size();
+    uint32_t columns = rows ? f.rows[0].size() : 0;
+
+    payload.clear();
+    PayloadWriter w{payload};
+
+    w.put(labelSize);
+    w.put(f.label.data(), labelSize);
+    w.put(f.samples);
+    w.put(f.skipped);
+    w.put(f.candidates);
+    w.put(f.spectra);
+    w.put(rows);
+    w.put(columns);
+    for(auto &r : f.rows) w.column(r);
+}
+
+bool decode(const std::vector<char> &payload, FileFeatures &f){
+
+    PayloadReader r{payload.data(), payload.data() + payload.size()};
+    uint32_t labelSize = 0, rows = 0, columns = 0;
+
+    if(!r.take(labelSize) || labelSize > payload.size()) return 0;
+    f.label.resize(labelSize);
+
+    bool ok = r.take(&f.label[0], labelSize) && r.take(f.samples) && r.take(f.skipped)
+        && r.take(f.candidates) && r.take(f.spectra) && r.take(rows) && r.take(columns)
+        && (uint64_t)rows * columns * 4 == (uint64_t)(r.end - r.p);
+    if(!ok) return 0;
+
+    f.rows.resize(rows);
+    for(auto &row : f.rows) r.column(row, columns);
+
+    return 1;
+}
+
+void encode(const PitchTrack &t, std::vector<char> &payload){
+
+    // samples (u64), skipped (f32), hops (u32), then the columns one after
+    // another: hop, pitch, confidence, power, period, voiced, start.
+
+    uint32_t n = t.size();
+
+    payload.clear();
+    PayloadWriter w{payload};
+
+    w.put(t.samples);
+    w.put(t.skipped);
+    w.put(n);
+    w.column(t.hop);
+    w.column(t.pitch);
+    w.column(t.confidence);
+    w.column(t.power);
+    w.column(t.period);
+    w.column(t.voiced);
+    w.column(t.start);
+}
+
+bool decode(const std::vector<char> &payload, PitchTrack &t){
+
+    PayloadReader r{payload.data(), payload.data() + payload.size()};
+    uint32_t n = 0;
+
+    return r.take(t.samples) && r.take(t.skipped) && r.take(n)
+        && r.column(t.hop, n) && r.column(t.pitch, n) && r.column(t.confidence, n)
+        && r.column(t.power, n) && r.column(t.period, n) && r.column(t.voiced, n)
+        && r.column(t.start, n) && r.p == r.end;
+}
+
+bool RecordFile::open(std::string path){
+
+    records.clear();
+
+    // record: magic, key (2 x u64), payload size (u32), payload.
+
+    uint64_t good = 0;
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::vector<char> payload;
+
+        while(in){
+
+            uint32_t m = 0, size = 0;
+            Key key;
+
+            in.read((char*)&m, 4);
+            in.read((char*)&key.first, 8);
+            in.read((char*)&key.second, 8);
+            in.read((char*)&size, 4);
+            if(!in || m != magic) break;
+
+            payload.resize(size);
+            in.read(payload.data(), size);
+            if(!in) break;
+
+            records[key] = payload;
+            good = in.tellg();
+        }
+    }
+
+    // drop whatever follows the last whole record.
+    std::error_code error;
+    if(std::filesystem::exists(path, error) && std::filesystem::file_size(path, error) != good){
+        std::filesystem::resize_file(path, good, error);
+        if(error) return 0;
+    }
+
+    file.open(path, std::ios::binary | std::ios::app);
+    return file.good();
+}
+
+bool RecordFile::close(){
+    if(!file.is_open()) return 0;
+    file.close();
+    return !file.fail();
+}
+
+const std::vector<char> *RecordFile::find(Key key) const {
+    auto i = records.find(key);
+    return i == records.end() ? nullptr : &i->second;
+}
+
+bool RecordFile::store(Key key, const std::vector<char> &payload){
+
+    uint32_t size = payload.size();
+
+    file.write((const char*)&magic, 4);
+    file.write((const char*)&key.first, 8);
+    file.write((const char*)&key.second, 8);
+    file.write((const char*)&size, 4);
+    file.write(payload.data(), size);
+
+    return file.good();
+}
+
+/*****************************************************************************/
+// classifier /////////////////////////////////////////////////////////////////
+/*****************************************************************************/
+
+// the vowel classifiers trained in python (neural_network.py,
+// logistic_regression.py, decision_tree.py), run on feature rows like the
+// ones parse_to_csv writes. export_model.py writes them in this format,
+// little endian:
+//
+//  magic "VCM1" (u32), kind (u32), inputs (u32), classes (u32), one char
+//  per class, then
+//  mlp        layers (u32), per layer in (u32), out (u32), activation (u32),
+//             weights (in x out f32, row k for input k), bias (out f32)
+//  logistic   rows (u32, classes or 1 for two), coefficients (rows x inputs
+//             f32), intercepts (rows f32)
+//  tree       nodes (u32), left, right, feature (nodes i32 each, -1 for a
+//             leaf), threshold (nodes f64), class (nodes u32)
+//
+// A logistic regression is kept as a single identity layer. A row goes
+// through the layers as a batch, each layer is one matrix product over all
+// the rows with the bias added, so the weights are read once per batch. A
+// tree row goes left while x[feature] <= threshold, like sklearn.
+
+class Classifier {
+
+public:
+
+    enum Kind { mlp, logistic, tree };
+    enum Activation { identity, relu, sigmoid, tanh };
+
+    struct Layer {
+        unsigned in = 0, out = 0;
+        Activation activation = identity;
+        std::vector<float> weight, bias;
+        std::vector<float> packed;  // weight as affine reads it
+    };
+
+    bool load(std::string path);
+
+    // the labels of the n rows of inputs values at x, rows one after
+    // another. Gives the time per row in microseconds.
+    double classify(const float *x, unsigned n, char *labels);
+
+    Kind kind = mlp;
+    unsigned inputs = 0;
+
+    // the label of each class, in the order of the outputs.
+    std::string labels;
+
+    std::vector<Layer> layers;
+
+    // the tree, node 0 is the root.
+    std::vector<int32_t> left, right, feature;
+    std::vector<double> threshold;
+    std::vector<uint32_t> leaf;
+
+private:
+
+    static constexpr uint32_t magic = 0x314d4356;   // "VCM1"
+
+    // the activations of a batch, two layers at a time.
+    std::vector<float> from, to;
+
+    // y (n x out) = x (n x in) w (in x out) + bias.
+    static void affine(const float *x, unsigned n, Layer &layer, float *y);
+
+    // M rows of x (in wide) to M rows of y (out wide) with the packed weights.
+    template<unsigned M>
+    static void affine_rows(const float *x, const Layer &layer, float *y);
+
+    bool check();
+};
+
+bool Classifier::load(std::string path){
+
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if(!in) return 0;
+
+    std::vector<char> bytes(in.tellg());
+    in.seekg(0);
+    if(!in.read(bytes.data(), bytes.size())) return 0;
+
+    PayloadReader r{bytes.data(), bytes.data() + bytes.size()};
+
+    uint32_t m, k, n, classes;
+    if(!r.take(m) || m != magic || !r.take(k) || !r.take(n) || !r.take(classes)) return 0;
+    if(k > tree || classes == 0) return 0;
+
+    kind = (Kind)k;
+    inputs = n;
+    labels.resize(classes);
+    if(!r.take(&labels[0], classes)) return 0;
+
+    layers.clear();
+
+    if(kind == mlp){
+
+        uint32_t count;
+        if(!r.take(count)) return 0;
+
+        layers.resize(count);
+        for(Layer &l : layers){
+            uint32_t a;
+            if(!r.take(l.in) || !r.take(l.out) || !r.take(a) || a > tanh) return 0;
+            l.activation = (Activation)a;
+            uint64_t cells = (uint64_t)l.in * l.out;
+            if(cells > UINT32_MAX || !r.column(l.weight, cells) || !r.column(l.bias, l.out)) return 0;
+        }
+    }
+    else if(kind == logistic){
+
+        uint32_t rows;
+        std::vector<float> coefficients, intercepts;
+        if(!r.take(rows) || (uint64_t)rows * inputs > UINT32_MAX) return 0;
+        if(!r.column(coefficients, rows * inputs) || !r.column(intercepts, rows)) return 0;
+        if((uint64_t)inputs * classes > UINT32_MAX) return 0;
+
+        // two classes have one row, the score of the second against the first.
+        Layer l;
+        l.in = inputs;
+        l.out = classes;
+        l.weight.assign(inputs * classes, 0.0f);
+        l.bias.assign(classes, 0.0f);
+
+        if(rows == 1 && classes == 2){
+            for(unsigned i=0; i<inputs; i++) l.weight[i*2 + 1] = coefficients[i];
+            l.bias[1] = intercepts[0];
+        }
+        else if(rows == classes){
+            for(unsigned c=0; c<classes; c++){
+                for(unsigned i=0; i<inputs; i++) l.weight[i*classes + c] = coefficients[c*inputs + i];
+                l.bias[c] = intercepts[c];
+            }
+        }
+        else return 0;
+
+        layers.push_back(std::move(l));
+    }
+    else {
+
+        uint32_t nodes;
+        if(!r.take(nodes)) return 0;
+        if(!r.column(left, nodes) || !r.column(right, nodes) || !r.column(feature, nodes)) return 0;
+        if(!r.column(threshold, nodes) || !r.column(leaf, nodes)) return 0;
+    }
+
+    return r.p == r.end && check();
+}
+
+bool Classifier::check(){
+
+    if(kind != tree){
+
+        if(layers.empty() || layers[0].in != inputs || layers.back().out != labels.size()) return 0;
+        for(unsigned i=1; i<layers.size(); i++) if(layers[i].in != layers[i-1].out) return 0;
+
+        // affine reads in * out weights and out biases, whatever the vectors hold.
+        for(const Layer &l : layers){
+            if(l.weight.size() != (uint64_t)l.in * l.out || l.bias.size() != l.out) return 0;
+        }
+        return 1;
+    }
+
+    // every child comes after its parent, so classify can't loop.
+    unsigned nodes = left.size();
+    if(nodes == 0) return 0;
+    if(right.size() != nodes || feature.size() != nodes) return 0;
+    if(threshold.size() != nodes || leaf.size() != nodes) return 0;
+
+    for(unsigned i=0; i<nodes; i++){
+        if(left[i] < 0){
+            if(leaf[i] >= labels.size()) return 0;
+            continue;
+        }
+        if(left[i] <= (int)i || right[i] <= (int)i) return 0;
+        if((unsigned)left[i] >= nodes || (unsigned)right[i] >= nodes) return 0;
+        if(feature[i] < 0 || (unsigned)feature[i] >= inputs) return 0;
+    }
+
+    return 1;
+}
+
+template<unsigned M>
+void Classifier::affine_rows(const float *__restrict x, const Layer &layer, float *__restrict y){
+
+    const unsigned in = layer.in, out = layer.out, blocks = (out + 7) / 8;
+
+    for(unsigned b=0; b<blocks; b++){
+
+        const float *__restrict w = layer.packed.data() + (size_t)b*in*8;
+        const unsigned lanes = std::min(8u, out - b*8);
+
+        float sum[M][8];
+
+#ifdef __AVX2__
+        __m256 s[M];
+        for(unsigned q=0; q<M; q++) s[q] = _mm256_setzero_ps();
+
+        for(unsigned k=0; k<in; k++){
+            __m256 wk = _mm256_loadu_ps(w + k*8);
+            for(unsigned q=0; q<M; q++){
+                s[q] = _mm256_add_ps(s[q], _mm256_mul_ps(_mm256_set1_ps(x[q*in + k]), wk));
+            }
+        }
+
+        for(unsigned q=0; q<M; q++) _mm256_storeu_ps(sum[q], s[q]);
+#else
+        for(unsigned q=0; q<M; q++) std::fill(sum[q], sum[q] + 8, 0.0f);
+
+        for(unsigned k=0; k<in; k++){
+            for(unsigned q=0; q<M; q++){
+                const float a = x[q*in + k];
+                for(unsigned t=0; t<8; t++) sum[q][t] += a * w[k*8 + t];
+            }
+        }
+#endif
+
+        float bias[8] = {};
+        std::copy(layer.bias.data() + b*8, layer.bias.data() + b*8 + lanes, bias);
+
+        for(unsigned q=0; q<M; q++){
+            for(unsigned t=0; t<lanes; t++) y[q*out + b*8 + t] = sum[q][t] + bias[t];
+        }
+    }
+}
+
+void Classifier::affine(const float *x, unsigned n, Layer &layer, float *y){
+
+    const unsigned in = layer.in, out = layer.out, blocks = (out + 7) / 8;
+
+    // the outputs in blocks of 8, the weights of a block one input after
+    // another and zero past out. An 8 wide sum stays in a register across
+    // all the inputs, for 4 rows at a time.
+
+    if(layer.packed.size() != (size_t)in * blocks * 8){
+        layer.packed.assign((size_t)in * blocks * 8, 0.0f);
+        for(unsigned b=0; b<blocks; b++){
+            for(unsigned k=0; k<in; k++){
+                for(unsigned t=0; t<8 && b*8+t < out; t++){
+                    layer.packed[((size_t)b*in + k)*8 + t] = layer.weight[(size_t)k*out + b*8+t];
+                }
+            }
+        }
+    }
+
+    unsigned r = 0;
+    for(; r+4<=n; r+=4) affine_rows<4>(x + (size_t)r*in, layer, y + (size_t)r*out);
+    for(; r<n; r++) affine_rows<1>(x + (size_t)r*in, layer, y + (size_t)r*out);
+
+    float *__restrict v = y;
+    const size_t size = (size_t)n * out;
+
+    switch(layer.activation){
+        case identity: break;
+        case relu: for(size_t i=0; i<size; i++) v[i] = std::max(v[i], 0.0f); break;
+        case sigmoid: for(size_t i=0; i<size; i++) v[i] = 1.0f / (1.0f + std::exp(-v[i])); break;
+        case tanh: for(size_t i=0; i<size; i++) v[i] = std::tanh(v[i]); break;
+    }
+}
+
+double Classifier::classify(const float *x, unsigned n, char *out){
+
+    auto begin = std::chrono::steady_clock::now();
+
+    if(kind == tree){
+
+        for(unsigned r=0; r<n; r++){
+            const float *row = x + (size_t)r*inputs;
+            int i = 0;
+            while(left[i] >= 0) i = row[feature[i]] <= threshold[i] ? left[i] : right[i];
+            out[r] = labels[leaf[i]];
+        }
+    }
+    else {
+
+        const float *a = x;
+
+        for(Layer &l : layers){
+            to.resize((size_t)n * l.out);
+            affine(a, n, l, to.data());
+            std::swap(from, to);
+            a = from.data();
+        }
+
+        // the first largest output, like numpy's argmax.
+        const unsigned classes = labels.size();
+        for(unsigned r=0; r<n; r++){
+            const float *y = a + (size_t)r*classes;
+            unsigned best = std::max_element(y, y + classes) - y;
+            out[r] = labels[best];
+        }
+    }
+
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+    return n ? us / n : 0.0;
+}
+
+// classifies the rows of a csv of features, like the _input.csv files, and
+// prints a label per row. The time per row goes to stderr, for the whole
+// file as one batch and for the rows one at a time.
+int classify_csv(std::string model, std::string input){
+
+    Classifier classifier;
+    if(!classifier.load(model)){
+        std::cerr << "can't load " << model << '\n';
+        return 1;
+    }
+
+    std::ifstream in(input);
+    if(!in) return 1;
+
+    std::vector<float> x;
+    unsigned n = 0;
+
+    for(std::string line; std::getline(in, line);){
+
+        const char *c = line.data(), *end = c + line.size();
+        unsigned columns = 0;
+
+        for(; c < end; columns++){
+            float v;
+            auto r = std::from_chars(c, end, v);
+            if(r.ec != std::errc()) break;
+            x.push_back(v);
+            c = r.ptr + (r.ptr < end && *r.ptr == ',');
+        }
+
+        if(columns != classifier.inputs){
+            std::cerr << input << ':' << n+1 << " has " << columns << " values, not "
+                << classifier.inputs << '\n';
+            return 1;
+        }
+        n++;
+    }
+
+    std::string labels(n, ' ');
+    double batch = classifier.classify(x.data(), n, &labels[0]);
+
+    double single = 0.0;
+    char label;
+    for(unsigned r=0; r<n; r++){
+        single += classifier.classify(x.data() + (size_t)r*classifier.inputs, 1, &label);
+        if(label != labels[r]){
+            std::cerr << input << ':' << r+1 << " is " << labels[r] << " in a batch but "
+                << label << " alone\n";
+            return 1;
+        }
+    }
+
+    for(char l : labels) std::cout << l << '\n';
+
+    std::cerr << n << " rows, " << batch << " us per row in a batch, "
+        << (n ? single / n : 0.0) << " us one at a time\n";
+
+    return 0;
+}
+
+/*****************************************************************************/
+// parser /////////////////////////////////////////////////////////////////////
+/*****************************************************************************/
+
+// a random number that only depends on its arguments: the counter-th
+// output of splitmix64 on a stream keyed by seed and stream. Drawing one
+// doesn't depend on what was drawn before, or where.
+uint64_t counter_random(uint64_t seed, uint64_t stream, uint64_t counter){
+
+    auto mix = [](uint64_t z) -> uint64_t {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    };
+
+    const uint64_t golden = 0x9e3779b97f4a7c15ull;
+
+    uint64_t key = mix(mix(seed + golden) ^ stream);
+    return mix(key + (counter + 1) * golden);
+}
+
+// csv writes output_input.csv and output_label.csv. npy writes the same
+// rows to output_input.npy (float32, rows x 100) and output_label.npy (uint8,
+// the ascii code of the label, .view('S1') gives the letters), and a json
+// sidecar output.json with the parameters and which rows came from which file.
+enum class Format { csv, npy };
+
+// what is extracted from the energies of the harmonics of a frame. Each
+// gives 100 values, on a 60 Hz grid from 60 Hz to 6 kHz for the first two.
+//  amplitude   the amplitudes interpolated linearly to the grid, summing to 10.
+//  energy      the energies spread to the grid with a sinc^2 kernel, summing to 10.
+//  harmonics   the energies of the harmonics 1 .. 100 as they are, zero above 6 kHz.
+enum class Feature { amplitude, energy, harmonics };
+
+std::string feature_name(Feature feature){
+    switch(feature){
+        case Feature::amplitude: return "amplitude";
+        case Feature::energy: return "energy";
+        case Feature::harmonics: return "harmonics";
+    }
+    return "";
+}
+
+// the frames parse_to_csv and the vowel service take go through these, so
+// the rows the service classifies are made like the training rows.
+
+// a voiced frame is used if its pitch is in this range.
+bool vowel_pitch(float pitch){
+    return pitch > 80.0f && pitch < 500.0f;
+}
+
+// the energies of the harmonics of a window of n samples up to 6 kHz,
+// energy[j] is the harmonic j+1. Gives 0 if the frame is too quiet to use.
+// work is the transform's, see math::WindowedFT.
+bool harmonic_energies(const float *window, unsigned n, float pitch, std::vector<float> &energy,
+        math::WindowedFT &work){
+
+    auto &freq = math::cos_window_ft(work, window, n, (unsigned)std::ceil(6000.0f / pitch));
+
+    energy.resize(freq.size());
+    float sum = 0.0f;
+    for(unsigned i=0; i<freq.size(); i++){
+        energy[i] = freq[i].real()*freq[i].real() + freq[i].imag()*freq[i].imag();
+        sum += energy[i];
+    }
+
+    return sum > 1e-3;
+}
+
+// scales the n values to sum to 10.
+void normalize_row(float *out, unsigned n){
+
+    float sum = 0.0f;
+    for(unsigned i=0; i<n; i++) sum += out[i];
+
+    const float norm = 10.0f;
+    sum = norm / sum;
+
+    for(unsigned i=0; i<n; i++) out[i] *= sum;
+}
+
+// the amplitude feature of the energies to out[0..99], see Feature.
+void amplitude_row(GridOperator &amplitudes, const std::vector<float> &energy, float pitch, float *out){
+    amplitudes.build(pitch, energy.size());
+    amplitudes.apply(energy.data(), out, 1);
+    normalize_row(out, 100);
+}
+
+// the sorted files are cut into count runs of consecutive files, and a
+// shard only parses run index. See merge_shards.
+struct Shard {
+    unsigned index = 0, count = 1;
+};
+
+// where shard writes when output is the name of the whole: output itself
+// for a single shard, output.<index>-of-<count> otherwise.
+std::string shard_output(const std::string &output, Shard shard){
+    if(shard.count == 1) return output;
+    return output + "." + std::to_string(shard.index) + "-of-" + std::to_string(shard.count);
+}
+
+// the files of feature k start with this.
+std::string feature_prefix(const std::string &output, const std::vector<Feature> &features, unsigned k){
+    return features.size() == 1 ? output : output + "_" + feature_name(features[k]);
+}
+
+// the json sidecar of the npy output of a feature. parameters is a json
+// object, files the entries of the files list, one per line after a newline.
+// merge_shards reads these back line by line.
+bool write_sidecar(const std::string &prefix, Feature feature, uint64_t rows,
+        const std::string &parameters, const std::string &files){
+
+    std::ofstream sidecar(prefix+".json");
+    sidecar << "{\n"
+        << "  \"feature\": " << json_string(feature_name(feature)) << ",\n"
+        << "  \"features\": " << json_string(prefix+"_input.npy") << ",\n"
+        << "  \"labels\": " << json_string(prefix+"_label.npy") << ",\n"
+        << "  \"label_encoding\": \"ascii\",\n"
+        << "  \"rows\": " << rows << ",\n"
+        << "  \"columns\": 100,\n"
+        << "  \"parameters\": " << parameters << ",\n"
+        << "  \"files\": [" << files << "\n  ]\n"
+        << "}\n";
+
+    return sidecar.good();
+}
+
+// the files are parsed on threads workers (0 = one per core), longest first.
+// The frames of a file are drawn with counter_random from seed, the file
+// contents and the hop, and the rows are written in sorted file order, so
+// the output only depends on seed, not on the thread count or the shards.
+// The same seed gives the same rows, another one other frames.
+// With a cache path the features of each file are stored under a hash of
+// its contents and all the parameters (seed included, so fix the seed), and
+// files already in the cache aren't decoded again.
+// With a tracks path the pitch tracks are stored the same way, under the
+// contents and the detector parameters only. When the features change but
+// the detection doesn't, the tracks are reused and only the windows of the
+// chosen frames are read from the files.
+// All the features are extracted from the same frames in one pass. With
+// more than one, each goes to its own files, named output_<feature name>.
+// sync fsyncs the csv files at the end.
+int parse_to_csv(std::string directory, std::string output, unsigned N,
+        Format format = Format::csv, unsigned threads = 0, uint64_t seed = 0,
+        std::string cache = "", std::string tracks = "",
+        std::vector<Feature> features = {Feature::amplitude}, Shard shard = Shard(),
+        bool sync = 0){
+
+    using std::vector;
+    using std::complex;
+
+    auto iswave = [](std::string &s) -> bool {
+        if(s.size() < 4) return 0;
+        return s.substr(s.size()-4) == ".wav";
+    };
+
+    std::vector<std::string> files;
+    try {
+        for(auto &file : std::filesystem::directory_iterator(directory)){
+            std::string f = file.path();
+            if(!iswave(f)) continue;
+            files.push_back(f);
+        }
+    }
+    catch(const std::filesystem::filesystem_error &e){
+        return 1;
+    }
+
+    // directory order isn't stable.
+    std::sort(files.begin(), files.end());
+
+    if(shard.count == 0 || shard.index >= shard.count) return 1;
+    {
+        size_t n = files.size();
+        size_t from = n * shard.index / shard.count, to = n * (shard.index + 1) / shard.count;
+        files = std::vector<std::string>(files.begin() + from, files.begin() + to);
+    }
+
+    if(features.empty()) return 1;
+
+    // the outputs of each feature.
+    struct Sink {
+        std::string prefix;
+        CsvWriter spectrums, labels;
+        std::chars_format notation = std::chars_format::fixed;
+        NpyWriter spectrumArray, labelArray;
+    };
+
+    vector<Sink> sinks(features.size());
+
+    for(unsigned k=0; k<features.size(); k++){
+
+        Sink &o = sinks[k];
+        o.prefix = feature_prefix(output, features, k);
+
+        if(format == Format::csv){
+
+            if(!o.spectrums.open(o.prefix+"_input.csv", sync)) return 1;
+            if(!o.labels.open(o.prefix+"_label.csv", sync)) return 1;
+
+            // the raw energies are mostly far below 1e-6.
+            if(features[k] == Feature::harmonics) o.notation = std::chars_format::scientific;
+        }
+        else {
+            if(!o.spectrumArray.open(o.prefix+"_input.npy", "<f4", 100)) return 1;
+            if(!o.labelArray.open(o.prefix+"_label.npy", "|u1")) return 1;
+        }
+    }
+
+    unsigned step = 128;
+
+    // all the features of a frame one after another. energy[j] is the
+    // harmonic j+1, at (j+1)*pitch. The amplitudes are interpolated
+    // linearly, the energies spread with sinc^2, both onto 100 points 60 Hz
+    // apart, see GridOperator.
+    auto extract = [&](GridOperator &amplitudes, GridOperator &energies,
+            const vector<float> &energy, float pitch) -> vector<float> {
+
+        vector<float> all(100 * features.size(), 0.0f);
+        float *out = all.data();
+
+        for(Feature feature : features){
+
+            switch(feature){
+                case Feature::amplitude:
+                    amplitude_row(amplitudes, energy, pitch, out);
+                    break;
+                case Feature::energy:
+                    energies.build(pitch, energy.size());
+                    energies.apply(energy.data(), out);
+                    normalize_row(out, 100);
+                    break;
+                case Feature::harmonics:
+                    std::copy(energy.begin(), energy.begin() + std::min<size_t>(100, energy.size()), out);
+                    break;
+            }
+
+            out += 100;
+        }
+
+        return all;
+    };
+
+    auto get_label = [](std::string s) -> std::string {
+        int n = s.size();
+        int i = n-1;
+        for(; i>=0; i--){ if(s[i] == '/') break; }
+        if(s[i] != '/') return "a";
+        return s.substr(i+2, 1);
+    };
+
+    // balance by duration: the longest files go first, so the last ones
+    // to finish are short. Only the headers are read here.
+
+    vector<unsigned> order(files.size());
+    vector<uint64_t> duration(files.size(), 0);
+
+    for(unsigned i=0; i<files.size(); i++){
+        order[i] = i;
+        iwstream I;
+        if(I.open(files[i])) duration[i] = I.get_sample_amount();
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b){
+        return duration[a] > duration[b];
+    });
+
+    // a worker's memory is allocated once and reused for all of its files.
+    // the silence around the speech is skipped. The padding lets the
+    // detector fill its buffer before the speech starts.
+
+    struct Worker {
+        change::Detector detector;
+        change::Prescan prescan;
+        vector<float> samples, waves, window;
+        vector<char> bytes, payload;
+        math::WindowedFT transform;
+        PitchTrack track;
+        GridOperator amplitudes{GridOperator::linear}, energies{GridOperator::sinc2};
+    };
+
+    // the prescan blocks are as long as the detector's quiet check, so
+    // the levels mean the same. waves holds a whole number of both.
+
+    auto setup = [&](Worker &w) -> void {
+        w.samples.resize(step);
+        w.prescan.block = w.detector.size / 2;
+        w.prescan.pad = 2 * w.detector.size + step;
+        w.waves.resize(step * w.prescan.block);
+        w.bytes.resize(1 << 20);
+    };
+
+    struct Parsed : FileFeatures {
+        bool done = 0, cached = 0, trackCached = 0;
+        RecordFile::Key key, trackKey;
+        vector<char> track;     // the encoded track to store
+        vector<std::string> text;   // the csv rows of each sink
+    };
+
+    // in csv the rows are formatted by the workers, write only copies them.
+    // Gives the time it took.
+    auto format_rows = [&](Parsed &r) -> double {
+
+        if(format != Format::csv) return 0.0;
+
+        auto begin = std::chrono::steady_clock::now();
+
+        r.text.resize(sinks.size());
+        for(unsigned k=0; k<sinks.size(); k++){
+            for(auto &row : r.rows){
+                CsvWriter::format_row(r.text[k], row.data() + 100*k, 100, sinks[k].notation);
+            }
+        }
+
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+
+    // everything the tracks and the features depend on besides the file.
+    // Bump the versions when the detection or the feature code changes.
+
+    uint64_t trackParameters, parameters;
+    {
+        const uint32_t trackVersion = 1, version = 3;
+
+        Worker w;
+        setup(w);
+        auto &d = w.detector;
+        auto &p = w.prescan;
+
+        vector<char> all;
+        PayloadWriter put{all};
+
+        put.put(trackVersion); put.put(step);
+        put.put(d.size); put.put(d.peakWindowMax); put.put(d.trustLimit); put.put(d.minCutoff);
+        put.put(d.voicedThreshold); put.put(d.quietThreshold); put.put(d.momentumDecay);
+        put.put(d.incremental); put.put(d.refreshInterval); put.put(d.decimation);
+        put.put(d.refine); put.put(d.lookahead);
+        put.put(p.block); put.put(p.pad); put.put(p.enter); put.put(p.exit);
+        put.put(p.floorQuantile); put.put(p.enterOverFloor); put.put(p.exitOverFloor);
+
+        trackParameters = hash_bytes(all.data(), all.size());
+
+        put.put(version); put.put(N); put.put(seed);
+        for(Feature feature : features) put.put(feature);
+
+        parameters = hash_bytes(all.data(), all.size());
+    }
+
+    RecordFile featureStore, trackStore;
+    if(!cache.empty() && !featureStore.open(cache)) return 1;
+    if(!tracks.empty() && !trackStore.open(tracks)) return 1;
+
+    auto parse = [&](Worker &w, unsigned index, Parsed &result) -> void {
+
+        const std::string &f = files[index];
+        auto &detector = w.detector;
+        auto &waves = w.waves;
+
+        // the keys and the random stream come from the raw file contents,
+        // hashed a chunk of bytes at a time.
+        uint64_t content;
+        {
+            std::ifstream in(f, std::ios::binary | std::ios::ate);
+            if(!in) return;
+            size_t n = in.tellg();
+            in.seekg(0);
+
+            Hasher hashers[] = {{parameters, n}, {~parameters, n},
+                {trackParameters, n}, {~trackParameters, n}, {0, n}};
+
+            for(size_t at = 0; at < n;){
+                size_t part = std::min(w.bytes.size(), n - at);
+                in.read(w.bytes.data(), part);
+                if(!in) return;
+                for(Hasher &h : hashers) h.add(w.bytes.data(), part);
+                at += part;
+            }
+
+            result.key = {hashers[0].digest(), hashers[1].digest()};
+            result.trackKey = {hashers[2].digest(), hashers[3].digest()};
+            content = hashers[4].digest();
+        }
+
+        if(const vector<char> *hit = featureStore.find(result.key)){
+            if(decode(*hit, result)){
+                if(!result.rows.empty()) result.label = get_label(f);
+                result.cached = 1;
+                return;
+            }
+            static_cast<FileFeatures&>(result) = FileFeatures();
+        }
+
+        iwstream I;
+        if(!I.open(f)) return;
+
+        PitchTrack &track = w.track;
+        const vector<char> *trackHit = trackStore.find(result.trackKey);
+
+        // window(begin, n, first) gives the samples [begin, begin + n) like the
+        // detector buffer has them, zero before the sample first. Only the
+        // windows of the chosen frames are read.
+        vector<float> &window = w.window;
+
+        auto read_window = [&](int64_t begin, unsigned n, int64_t first){
+            window.assign(n, 0.0f);
+            int64_t from = std::max(begin, first);
+            if(from < begin + n) I.read_silent(window.data() + (from - begin), from, begin + n - from);
+        };
+
+        if(trackHit && decode(*trackHit, track)){
+            result.trackCached = 1;
+        }
+        else {
+
+            // the file is streamed twice, once for the envelope and once
+            // through the regions, a chunk of waves at a time.
+
+            const uint64_t samples = I.get_sample_amount();
+
+            w.prescan.clear();
+            I.seek(0);
+            for(uint64_t at = 0; at < samples;){
+                unsigned n = I.read_move(waves.data(), std::min<uint64_t>(waves.size(), samples - at));
+                if(n == 0) break;
+                w.prescan.append(waves.data(), n);
+                at += n;
+            }
+
+            auto regions = w.prescan.finish();
+
+            track.clear();
+            track.samples = samples;
+            track.skipped = w.prescan.skipped;
+
+            for(auto region : regions){
+
+                detector.reset();
+
+                // the hops stay at multiples of step, like when reading the file hop by hop.
+
+                uint64_t at = region.begin / step * step;
+                unsigned used = 0, filled = 0;
+                I.seek(at);
+
+                for(; at < region.end && at + step <= samples; at += step){
+
+                    if(used == filled){
+                        filled = I.read_move(waves.data(), std::min<uint64_t>(waves.size(), samples - at));
+                        used = 0;
+                        if(filled < step) break;
+                    }
+
+                    std::copy(waves.begin() + used, waves.begin() + used + step, w.samples.begin());
+                    used += step;
+                    detector.feed(w.samples);
+
+                    track.start.push_back(at == region.begin / step * step);
+                    track.hop.push_back(at / step);
+                    track.pitch.push_back(detector.pitch);
+                    track.confidence.push_back(detector.confidence);
+                    track.power.push_back(detector.get_power());
+                    track.period.push_back(detector.period);
+                    track.voiced.push_back(detector.voiced);
+                }
+            }
+
+        }
+
+        result.samples = track.samples;
+        result.skipped = track.skipped;
+
+        // N frames are sampled uniformly from the voiced hops whose spectrum
+        // has some energy. Every candidate hop gets a random key and the N
+        // lowest keys are kept in a max heap. The spectrum is only computed
+        // for the hops whose key would make it into the heap, about
+        // N * (1 + ln(hops / N)) of them instead of all.
+
+        struct Frame {
+            double key;
+            float pitch;
+            vector<float> energy;
+            bool operator<(const Frame &o) const { return key < o.key; }
+        };
+
+        vector<Frame> reservoir;
+
+        // the first sample the detector was fed since its last reset.
+        int64_t first = 0;
+
+        for(unsigned h=0; h<track.size(); h++){
+
+            if(track.start[h]) first = (int64_t)track.hop[h] * step;
+
+            float pitch = track.pitch[h];
+            if(!track.voiced[h] || !vowel_pitch(pitch)) continue;
+
+            double key = (counter_random(seed, content, track.hop[h]) >> 11) * 0x1.0p-53;
+            result.candidates++;
+
+            if(N == 0 || (reservoir.size() == N && key >= reservoir.front().key)) continue;
+
+            // the same samples as Detector::get2 gives after the feed.
+            unsigned amount = std::min<unsigned>(track.period[h], detector.size / 2);
+            int64_t point = (int64_t)(track.hop[h] + 1) * step - detector.delay();
+            read_window(point - amount, 2 * amount, first);
+
+            vector<float> e;
+            result.spectra++;
+            if(!harmonic_energies(window.data(), window.size(), pitch, e, w.transform)) continue;
+
+            reservoir.push_back({key, pitch, std::move(e)});
+            std::push_heap(reservoir.begin(), reservoir.end());
+
+            if(reservoir.size() > N){
+                std::pop_heap(reservoir.begin(), reservoir.end());
+                reservoir.pop_back();
+            }
+        }
+
+        if(trackStore.is_open() && !result.trackCached) encode(track, result.track);
+
+        if(reservoir.size() < N) return;
+
+        // by key, that is in random order.
+        std::sort_heap(reservoir.begin(), reservoir.end());
+
+        result.label = get_label(f);
+
+        for(unsigned i=0; i<N; i++){
+            auto out = extract(w.amplitudes, w.energies, reservoir[i].energy, reservoir[i].pitch);
+            for(float i : out) assert(!std::isnan(i) && !std::isinf(i));
+            result.rows.push_back(std::move(out));
+        }
+    };
+
+    vector<Parsed> parsed(files.size());
+    uint64_t totalSamples = 0, skippedSamples = 0, totalCandidates = 0, totalSpectra = 0;
+    unsigned cachedFiles = 0, trackedFiles = 0;
+
+    // finished files are written as soon as all the files before them are.
+    // provenance is the json list of the files that gave rows.
+    std::mutex writing;
+    unsigned written = 0;
+    uint64_t rows = 0;
+    std::string provenance;
+    double formatSeconds = 0.0;
+
+    auto write = [&]() -> void {
+
+        for(; written < files.size() && parsed[written].done; written++){
+
+            Parsed &r = parsed[written];
+
+            totalSamples += r.samples;
+            skippedSamples += std::llround(r.skipped * r.samples);
+            totalCandidates += r.candidates;
+            totalSpectra += r.spectra;
+            cachedFiles += r.cached;
+
+            if(featureStore.is_open() && !r.cached && r.key != RecordFile::Key()){
+                vector<char> payload;
+                encode(r, payload);
+                featureStore.store(r.key, payload);
+            }
+            if(trackStore.is_open() && !r.track.empty()) trackStore.store(r.trackKey, r.track);
+            trackedFiles += r.trackCached;
+
+            if(r.rows.empty()) continue;
+
+            // a row has the features one after another.
+
+            for(unsigned k=0; k<sinks.size(); k++){
+
+                Sink &o = sinks[k];
+
+                if(format == Format::csv){
+                    o.spectrums.write(r.text[k]);
+                    std::string line = r.label + '\n';
+                    for(unsigned i=0; i<r.rows.size(); i++) o.labels.write(line);
+                }
+                else {
+                    uint8_t code = r.label[0];
+                    for(auto &row : r.rows){
+                        o.spectrumArray.write(row.data() + 100*k);
+                        o.labelArray.write(&code);
+                    }
+                }
+            }
+
+            provenance += std::string(provenance.empty() ? "" : ",") + "\n    {\"path\": "
+                + json_string(files[written]) + ", \"label\": " + json_string(r.label)
+                + ", \"first\": " + std::to_string(rows) + ", \"rows\": " + std::to_string(r.rows.size())
+                + ", \"samples\": " + std::to_string(r.samples) + "}";
+            rows += r.rows.size();
+
+            std::cerr << files[written] << ' ' << r.label << " skipped " << r.skipped << '\n';
+
+            r = Parsed();
+            r.done = 1;
+        }
+    };
+
+    if(threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::max(1u, std::min<unsigned>(threads, files.size()));
+
+    std::atomic<unsigned> next(0);
+
+    auto work = [&]() -> void {
+
+        Worker w;
+        setup(w);
+
+        for(unsigned k; (k = next++) < order.size();){
+
+            Parsed result;
+            parse(w, order[k], result);
+            result.done = 1;
+            double seconds = format_rows(result);
+
+            std::lock_guard<std::mutex> lock(writing);
+            formatSeconds += seconds;
+            parsed[order[k]] = std::move(result);
+            write();
+        }
+    };
+
+    vector<std::thread> pool;
+    for(unsigned t=1; t<threads; t++) pool.emplace_back(work);
+    work();
+    for(auto &t : pool) t.join();
+
+    if(totalSamples){
+        std::cerr << "skipped " << (double)skippedSamples / totalSamples
+            << " of the audio as silence\n";
+    }
+    if(totalCandidates){
+        std::cerr << "computed " << totalSpectra << " spectra for "
+            << totalCandidates << " voiced hops\n";
+    }
+    if(featureStore.is_open()){
+        std::cerr << cachedFiles << " of " << files.size() << " files from the cache\n";
+        if(!featureStore.close()) return 1;
+    }
+    if(trackStore.is_open()){
+        std::cerr << trackedFiles << " of " << files.size() << " pitch tracks reused\n";
+        if(!trackStore.close()) return 1;
+    }
+
+    if(format == Format::csv){
+
+        uint64_t bytes = 0;
+        double writeSeconds = 0.0;
+        bool ok = 1;
+
+        for(Sink &o : sinks){
+            ok &= o.spectrums.close();
+            ok &= o.labels.close();
+            bytes += o.spectrums.bytes() + o.labels.bytes();
+            writeSeconds += o.spectrums.seconds() + o.labels.seconds();
+        }
+
+        double mb = bytes / 1e6;
+        std::cerr << "wrote " << mb << " MB of csv, formatted at "
+            << mb / std::max(formatSeconds, 1e-9) << " MB/s, written at "
+            << mb / std::max(writeSeconds, 1e-9) << " MB/s\n";
+
+        if(!ok){
+            std::cerr << "couldn't write the csv\n";
+            return 1;
+        }
+    }
+
+    for(unsigned k=0; k<sinks.size() && format == Format::npy; k++){
+
+        Sink &o = sinks[k];
+
+        bool ok = o.spectrumArray.close();
+        ok &= o.labelArray.close();
+
+        std::string parameters = "{\"directory\": " + json_string(directory)
+            + ", \"per_file\": " + std::to_string(N) + ", \"seed\": " + std::to_string(seed)
+            + ", \"hop\": " + std::to_string(step)
+            + ", \"pitch_range\": [80, 500], \"harmonic_spacing\": 60, \"norm\": 10}";
+
+        ok &= write_sidecar(o.prefix, features[k], rows, parameters, provenance);
+
+        if(!ok) return 1;
+    }
+
+    return 0;
+}
+
+// joins the outputs of the count shards of a parse_to_csv run, written to
+// shard_output(output, {i, count}), into the files a single run writes to
+// output. The shards are consecutive runs of the sorted files and a file's
+// rows only depend on the seed and its contents, so the result is byte for
+// byte that of a single run. The shard files are left as they are.
+int merge_shards(std::string output, unsigned count, Format format = Format::csv,
+        std::vector<Feature> features = {Feature::amplitude}){
+
+    if(count == 0 || features.empty()) return 1;
+
+    std::vector<char> buffer(1 << 20);
+
+    for(unsigned k=0; k<features.size(); k++){
+
+        std::string prefix = feature_prefix(output, features, k);
+        std::vector<std::string> shards(count);
+        for(unsigned i=0; i<count; i++) shards[i] = feature_prefix(shard_output(output, {i, count}), features, k);
+
+        if(format == Format::csv){
+
+            for(std::string suffix : {"_input.csv", "_label.csv"}){
+
+                std::ofstream out(prefix + suffix, std::ios::binary | std::ios::trunc);
+
+                for(auto &shard : shards){
+                    std::ifstream in(shard + suffix, std::ios::binary);
+                    if(!in) return 1;
+                    while(in.read(buffer.data(), buffer.size()) || in.gcount()) out.write(buffer.data(), in.gcount());
+                }
+
+                if(!out) return 1;
+            }
+            continue;
+        }
+
+        // the arrays are copied after their headers, whole rows at a time.
+
+        NpyWriter spectrumArray, labelArray;
+        if(!spectrumArray.open(prefix+"_input.npy", "<f4", 100)) return 1;
+        if(!labelArray.open(prefix+"_label.npy", "|u1")) return 1;
+
+        for(auto &shard : shards){
+            for(NpyWriter *array : {&spectrumArray, &labelArray}){
+
+                std::ifstream in(shard + (array == &spectrumArray ? "_input.npy" : "_label.npy"),
+                        std::ios::binary);
+
+                char start[10];
+                if(!in.read(start, 10) || std::memcmp(start, "\x93NUMPY", 6)) return 1;
+                in.seekg(10 + (uint8_t)start[8] + ((uint8_t)start[9] << 8));
+
+                unsigned size = array->row_size();
+                uint64_t chunk = buffer.size() / size * size;
+
+                while(in.read(buffer.data(), chunk) || in.gcount()){
+                    if(in.gcount() % size) return 1;
+                    if(!array->write(buffer.data(), in.gcount() / size)) return 1;
+                }
+            }
+        }
+
+        uint64_t rows = spectrumArray.rows();
+        if(!spectrumArray.close() || !labelArray.close()) return 1;
+
+        // the sidecars have a line for the parameters, the same in all the
+        // shards, and one per file, whose first row moves by the rows of
+        // the shards before.
+
+        std::string parameters, files;
+        uint64_t offset = 0;
+
+        for(auto &shard : shards){
 
-        std::vector<float> onev(size), twov(size);
-        for(unsigned i=0; i<size; i++) onev[i] = buffer[size + i - two.move];
-        for(unsigned i=0; i<size; i++) twov[i] = buffer[size + i];
+            std::ifstream in(shard + ".json");
+            if(!in) return 1;
 
-        {
-            auto [omse, tmse] = math::autocorrelation(onev, twov);
-            one.mse.swap(omse);
-            one.mse.resize(size);
-            two.mse.swap(tmse);
-            two.mse.resize(size);
-        }
+            const std::string parameterKey = "  \"parameters\": ", firstKey = "\"first\": ";
+            uint64_t shardRows = 0;
 
-        auto process_mse = [&](std::vector<float> &time, Info &x) -> void {
-           
-            // convert to mse
+            for(std::string line; std::getline(in, line);){
 
-            float sum = 0.0f;
-            for(float i : time) sum += i*i;
-            sum *= 2;
+                if(line.compare(0, 4, "    ") == 0 && line.find("{\"path\"") != std::string::npos){
 
-            x.mse[0] = 2.0f;
-            x.voiced = 0.0f;
+                    if(line.back() == ',') line.pop_back();
 
-            for(unsigned i=1; i<size; i++){
-                sum -= time[i-1]*time[i-1] + time[size-i]*time[size-i];
-                if(i >= min && i <= max && sum != 0.0f) x.voiced = std::max(x.voiced, x.mse[i] / sum);
-                x.mse[i] = (sum - 2 * x.mse[i]) / (size - i);
-            }
+                    size_t at = line.find(firstKey);
+                    if(at == std::string::npos) return 1;
+                    at += firstKey.size();
+                    size_t end = line.find(',', at);
 
-            // normalize
+                    uint64_t first = std::stoull(line.substr(at, end - at));
+                    line.replace(at, end - at, std::to_string(first + offset));
 
-            sum = 0.0f;
-            for(unsigned i=1; i<size; i++){
-                sum += x.mse[i];
-                if(sum != 0.0f) x.mse[i] *= i / sum;
+                    files += std::string(files.empty() ? "" : ",") + "\n" + line;
+                }
+                else if(line.compare(0, parameterKey.size(), parameterKey) == 0){
+                    parameters = line.substr(parameterKey.size());
+                    if(!parameters.empty() && parameters.back() == ',') parameters.pop_back();
+                }
+                else if(line.compare(0, 10, "  \"rows\": ") == 0){
+                    shardRows = std::stoull(line.substr(10));
+                }
             }
-        };
-        
-        process_mse(onev, one);
-        process_mse(twov, two);
+
+            offset += shardRows;
+        }
+
+        if(offset != rows || parameters.empty()) return 1;
+        if(!write_sidecar(prefix, features[k], rows, parameters, files)) return 1;
     }
 
-    auto normalize = [&](Info &x) -> void {
+    return 0;
+}
 
-        float avg = 0.0f;
-        for(unsigned i=min; i<max; i++) avg += x.mse[i];
-        avg /= (max-min);
+/*****************************************************************************/
+// vowel service //////////////////////////////////////////////////////////////
+/*****************************************************************************/
 
-        if(avg > 1e-18){
-            float iavg = 1.0f / avg;
-            for(float &i : x.mse) i *= iavg;
-        } else {
-            for(float &i : x.mse) i = 2.0f;
+// the samples of a pcm or wave byte stream that arrives in pieces and can't
+// seek, unlike iwstream. A stream starting with "RIFF" is a wave file whose
+// header is read like iwstream::initialize does, once enough of it has
+// arrived. Anything else is raw 16 bit little endian mono at rawRate. Only
+// the first channel is kept.
+
+class PcmStream : public waveconfig {
+
+public:
+
+    PcmStream(unsigned rawRate = 44100);
+
+    // forget the stream, the next bytes start a new one.
+    void reset();
+
+    // appends the samples of the next n bytes to out. Gives 0 when the
+    // stream isn't something it can read.
+    bool push(const char *data, size_t n, std::vector<float> &out);
+
+    // the format is known, get_frame_rate and the rest are valid.
+    bool ready(){ return started && headerDone; }
+
+    // why push gave 0, null while it hasn't.
+    const char *error(){ return failure; }
+
+    unsigned rawRate;
+
+private:
+
+    bool started = 0, headerDone = 0;
+    const char *failure = nullptr;
+    uint32_t datatype = 0;
+    unsigned frameBytes = 0;
+
+    // the bytes of the header or of a partial frame.
+    std::vector<char> pending;
+
+    // 1 when the header is read, 0 when more bytes are needed.
+    bool read_header();
+};
+
+PcmStream::PcmStream(unsigned rawRate_) : rawRate(rawRate_) {}
+
+void PcmStream::reset(){
+    started = headerDone = 0;
+    failure = nullptr;
+    pending.clear();
+}
+
+bool PcmStream::read_header(){
+
+    using namespace wave_dialog;
+
+    const char *c = pending.data();
+    const size_t n = pending.size();
+
+    if(n < 12) return 0;
+    if(std::memcmp(c + 8, "WAVE", 4)){
+        failure = "a RIFF file that isn't a wave";
+        return 0;
+    }
+
+    bool haveFormat = 0;
+
+    for(size_t at = 12; at + 8 <= n;){
+
+        uint32_t size = listen_uint32(c + at + 4);
+
+        if(std::memcmp(c + at, "data", 4) == 0){
+
+            // the size of a streamed data chunk is often unknown, the data
+            // runs to the end of the stream.
+            if(!haveFormat){
+                failure = "the data chunk comes before the fmt chunk";
+                return 0;
+            }
+            pending.erase(pending.begin(), pending.begin() + at + 8);
+            return 1;
         }
-    };
-    
-    auto find_peak = [&](Info &x) -> void {
 
-        unsigned window = std::min(min/2, peakWindowMax);
-        
-        x.top = 0;
+        if(at + 8 + size > n) return 0;
 
-        // keep track of surrounding area using a multiset
-        std::multiset<float> s;
-        for(unsigned i=0; i<=2*window && i<size; i++) s.insert(x.mse[i]);
-        
-        x.value = 1.0f;
-        for(unsigned i=window; i<=max && i+window+1<size; i++){
-
-            // index i is a minimum in the surrounding range.
-            if(x.mse[i] == *s.begin() && i >= min && x.mse[i] < x.value){
-                x.value = x.mse[i];
-                x.top = i;
-                if(x.value < minCutoff) break;
+        if(std::memcmp(c + at, "fmt ", 4) == 0 && size >= 16){
+
+            const char *f = c + at + 8;
+
+            format = listen_uint16(f);
+            channels = listen_uint16(f + 2);
+            frameRate = listen_uint32(f + 4);
+            byteRate = listen_uint32(f + 8);
+            frameSize = listen_uint16(f + 12);
+            sampleBits = listen_uint16(f + 14);
+            sampleSize = sampleBits / 8;
+
+            subformat = format;
+            validSampleBits = sampleBits;
+
+            if(format == EXTENSIBLE && size >= 40){
+                validSampleBits = listen_uint16(f + 18);
+                channelMask = listen_uint32(f + 20);
+                std::memcpy(GUID, f + 24, 16);
+                subformat = listen_uint16(GUID);
             }
 
-            // update range
-            s.erase(s.find(x.mse[i-window]));
-            s.insert(x.mse[i+window+1]);
+            datatype = resolve_dialog(subformat, validSampleBits);
+            frameBytes = channels * sampleSize;
+
+            if(!datatype || channels == 0 || frameRate == 0){
+                failure = "a wave format it can't read";
+                return 0;
+            }
+            haveFormat = 1;
         }
-    };
 
-    normalize(one);
-    normalize(two);
-    
-    auto apply_momentum = [&](Info &x){
+        at += 8 + size + (size & 1);
+    }
 
-        float newWeight = x.voiced * power;
-        float oldWeight = std::pow(momentumDecay, (float)x.move / size);
+    return 0;
+}
 
-        for(unsigned i=0; i<size; i++){
-            momentum.mse[i] = newWeight * x.mse[i] + oldWeight * nonorm[i];
+bool PcmStream::push(const char *data, size_t n, std::vector<float> &out){
+
+    using namespace wave_dialog;
+
+    if(failure) return 0;
+
+    pending.insert(pending.end(), data, data + n);
+
+    if(!started){
+
+        if(pending.size() < 4) return 1;
+        started = 1;
+
+        if(std::memcmp(pending.data(), "RIFF", 4)){
+            config(PCM_ID, 1, 16, rawRate);
+            datatype = INT16_ID;
+            frameBytes = 2;
+            headerDone = 1;
         }
+    }
 
-        nonorm = momentum.mse;
-   
-        momentum.voiced = x.voiced;
-    };
+    if(!headerDone){
+        headerDone = read_header();
+        if(failure) return 0;
+        if(!headerDone) return 1;
+    }
 
-    apply_momentum(one);
-    apply_momentum(two);
-    normalize(momentum);
+    size_t frames = pending.size() / frameBytes;
+    const char *c = pending.data();
 
-    find_peak(momentum);
+    size_t at = out.size();
+    out.resize(at + frames);
+    float *o = out.data() + at;
 
-    Info &best = momentum;
+    switch(datatype){
+        case INT8_ID: for(size_t i=0; i<frames; i++) o[i] = listen_int8_as_float(c + i*frameBytes); break;
+        case INT16_ID: for(size_t i=0; i<frames; i++) o[i] = listen_int16_as_float(c + i*frameBytes); break;
+        case INT24_ID: for(size_t i=0; i<frames; i++) o[i] = listen_int24_as_float(c + i*frameBytes); break;
+        case INT32_ID: for(size_t i=0; i<frames; i++) o[i] = listen_int32_as_float(c + i*frameBytes); break;
+        case FLOAT32_ID: for(size_t i=0; i<frames; i++) o[i] = listen_float32(c + i*frameBytes); break;
+    }
 
-    // classify.
+    pending.erase(pending.begin(), pending.begin() + frames * frameBytes);
 
-    if(best.voiced > voicedThreshold){
-        
-        confidence = 1.0f - best.value;
+    return 1;
+}
 
-        voiced = 1;
-        period = best.top;
+// end to end latencies in a log scale histogram, 8 buckets per octave of
+// microseconds, and the counters of a service. Everything is atomic, the
+// sessions add to it without locking.
 
-        // quadratic interpolation is useful for high pitches
+struct ServiceStats {
 
-        pitch = (float)rate / period;
-        if(period > 1 && period + 1 <= max){
-            
-            std::array<float, 3> val = {
-                best.mse[period-1],
-                best.mse[period],
-                best.mse[period+1]
-            };
+    static const unsigned buckets = 8 * 32;
 
-            // construct a parabola using the three points around
-            // the peak. set the peak as origo and find the
-            // bottom of the parabola. val[0] and val[2] are at distance
-            // 1 from val[1] on the x -axis.
+    std::atomic<uint64_t> latency[buckets] = {};
+    std::atomic<uint64_t> sessions{0}, active{0}, bytes{0}, samples{0}, events{0}, vowels{0};
 
-            // y = ax^2 + bx
+    void add_latency(double us, uint64_t count = 1);
 
-            float y0 = val[0] - val[1], y1 = val[2] - val[1];
-            float a = (y1 + y0) / 2;
-            float b = (y1 - y0) / 2;
+    // the latency under which a fraction q of them are, in microseconds.
+    double percentile(double q);
 
-            float bottom = -b / (2*a);
+    // one line with the counters and the percentiles, rates over seconds.
+    std::string report(double seconds);
+};
 
-            if(bottom > -1.0f && bottom < 1.0f) pitch = (float)rate / (period + bottom);
-        }
+void ServiceStats::add_latency(double us, uint64_t count){
+    unsigned b = (unsigned)std::max(0.0, 8.0 * std::log2(1.0 + std::max(0.0, us)));
+    latency[std::min(b, buckets - 1)] += count;
+}
 
-        trust++;
+double ServiceStats::percentile(double q){
 
-    } else {
+    uint64_t total = 0;
+    for(auto &b : latency) total += b;
+    if(total == 0) return 0.0;
 
-        confidence = 1.0f - best.voiced;
-        voiced = 0;
-        trust = 0;
+    uint64_t want = std::max<uint64_t>(1, std::ceil(q * total)), seen = 0;
 
+    for(unsigned b=0; b<buckets; b++){
+        seen += latency[b];
+        if(seen >= want) return std::exp2((b + 1) / 8.0) - 1.0;
     }
+    return std::exp2(buckets / 8.0) - 1.0;
 }
 
-void Detector::reset(){
-    
-    buffer.clear();
-    buffer.resize(2*size, 0.0f);
-    
-    period = 0;
-    pitch = 0;
-    confidence = 0;
-    voiced = 0;
-    quiet = 1;
-    trust = 0;
-    
-    momentum.top = 0;
-    
-    for(float &i : nonorm) i = 0.0f;
+std::string ServiceStats::report(double seconds){
+
+    char line[512];
+    std::snprintf(line, sizeof(line),
+        "sessions %llu (%llu active), %.2f MB in, %.0f samples/s, %.0f events/s, %llu vowels,"
+        " latency us p50 %.0f p90 %.0f p99 %.0f p99.9 %.0f",
+        (unsigned long long)sessions, (unsigned long long)active, bytes / 1e6,
+        samples / std::max(seconds, 1e-9), events / std::max(seconds, 1e-9),
+        (unsigned long long)vowels,
+        percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999));
+
+    return line;
 }
 
-std::vector<float> Detector::get(unsigned amount){
+// one stream of audio turned into events, one per hop of 128 samples:
+//  {"time": s, "pitch": Hz, "voiced": 0 or 1, "vowel": "a", "confidence": c}
+// time is the analysis point of the hop from the start of the stream, the
+// confidence the detector's. Voiced hops between 80 and 500 Hz go through
+// the amplitude features of parse_to_csv and the classifier, the others
+// have an empty vowel.
 
-    if(amount == 0) amount = period;
-    amount = std::min(amount, max);
+class VowelSession {
 
-    std::vector<float> samples(amount);
-    for(unsigned i=0; i<amount; i++) samples[i] = buffer[size + i];
+public:
 
-    return samples;
-}
+    VowelSession(Classifier &classifier, unsigned rawRate = 44100);
 
-std::vector<float> Detector::get2(unsigned amount){
+    // a new stream.
+    void begin();
 
-    if(amount == 0) amount = period;
-    amount = std::min(amount, max);
-    
-    std::vector<float> samples(2*amount);
-    for(unsigned i=0; i<2*amount; i++) samples[i] = buffer[size - amount + i];
+    // the events of the next n bytes appended to events as json lines.
+    // Gives how many there are, -1 when the stream can't be read.
+    int feed(const char *data, size_t n, std::string &events, ServiceStats &stats);
+
+    // why feed gave -1.
+    const char *error(){ return stream.error(); }
+
+private:
+
+    static const unsigned step = 128;
+
+    Classifier &classifier;
+    PcmStream stream;
+    change::Detector detector;
+    unsigned rate = 0;
+
+    std::vector<float> samples, hop, energy, row;
+    math::WindowedFT transform;
+    GridOperator amplitudes{GridOperator::linear};
+
+    // the vowel of the current hop, 0 if there's none.
+    char classify();
+};
 
-    return samples;
+VowelSession::VowelSession(Classifier &classifier_, unsigned rawRate) :
+    classifier(classifier_),
+    stream(rawRate),
+    hop(step),
+    row(100)
+{}
+
+void VowelSession::begin(){
+    stream.reset();
+    samples.clear();
+    rate = 0;
 }
 
-std::vector<float> Detector::get_mse(){
-    return momentum.mse;
+char VowelSession::classify(){
+
+    float pitch = detector.pitch;
+    if(!detector.voiced || !vowel_pitch(pitch)) return 0;
+
+    // the window parse_to_csv takes for the same hop.
+    change::View w = detector.get2(std::min<unsigned>(detector.period, detector.size / 2));
+    if(!harmonic_energies(w.data(), w.size(), pitch, energy, transform)) return 0;
+
+    amplitude_row(amplitudes, energy, pitch, row.data());
+
+    char label;
+    classifier.classify(row.data(), 1, &label);
+    return label;
 }
 
-}   // namespace change
+int VowelSession::feed(const char *data, size_t n, std::string &events, ServiceStats &stats){
 
-/*****************************************************************************/
-// parser /////////////////////////////////////////////////////////////////////
-/*****************************************************************************/
+    if(!stream.push(data, n, samples)) return -1;
+    if(!stream.ready()) return 0;
 
-std::mt19937 rng32(std::chrono::steady_clock::now().time_since_epoch().count());
+    if(rate == 0){
+        rate = stream.get_frame_rate();
+        detector.reset(rate);
+    }
 
-int parse_to_csv(std::string directory, std::string output, unsigned N){
+    size_t at = 0;
+    int count = 0;
+    char line[160];
 
-    using std::vector;
-    using std::complex;
+    for(; at + step <= samples.size(); at += step){
 
-    auto iswave = [](std::string &s) -> bool {
-        if(s.size() < 4) return 0;
-        return s.substr(s.size()-4) == ".wav";
-    };
+        std::copy(samples.begin() + at, samples.begin() + at + step, hop.begin());
+        detector.feed(hop);
 
-    std::vector<std::string> files;
-    try {
-        for(auto &file : std::filesystem::directory_iterator(directory)){
-            std::string f = file.path();
-            if(!iswave(f)) continue;
-            files.push_back(f);
-        }
+        int64_t position = detector.position();
+        if(position < 0) continue;
+
+        char vowel = classify();
+        stats.vowels += vowel != 0;
+        stats.events++;
+        count++;
+
+        std::snprintf(line, sizeof(line),
+            "{\"time\": %.4f, \"pitch\": %.2f, \"voiced\": %d, \"vowel\": \"%s\", \"confidence\": %.3f}\n",
+            (double)position / rate, detector.pitch, (int)detector.voiced,
+            vowel ? std::string(1, vowel).c_str() : "", detector.confidence);
+        events += line;
     }
-    catch(const std::filesystem::filesystem_error &e){
-        return 1;
+
+    stats.samples += at;
+    samples.erase(samples.begin(), samples.begin() + at);
+
+    return count;
+}
+
+// a queue of at most capacity items. push waits while it's full, which
+// is the backpressure: a full queue stops the producer.
+template<class T>
+class BoundedQueue {
+
+public:
+
+    BoundedQueue(unsigned capacity_) : capacity(std::max(1u, capacity_)) {}
+
+    void push(T item){
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&]{ return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
     }
 
-    std::ofstream spectrums(output+"_input.csv"), labels(output+"_label.csv");
-    if(spectrums.bad() || labels.bad()) return 1;
+    T pop(){
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&]{ return !items.empty(); });
+        T item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return item;
+    }
 
-    spectrums << std::setprecision(6) << std::fixed;
-    labels << std::setprecision(6) << std::fixed;
+private:
 
-    unsigned step = 128;
+    unsigned capacity;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notFull, notEmpty;
+};
 
-    auto to_energy = [&](const vector<complex<float>> &in) -> vector<float> {
+struct ServiceConfig {
+    unsigned workers = 0;       // 0 = one per core
+    unsigned queue = 16;        // connections waiting for a worker
+    unsigned rawRate = 44100;   // the rate of raw pcm streams
+    double statsInterval = 10;  // seconds between the stats lines, 0 = none
+};
 
-        vector<float> out;
-        for(auto i : in) out.push_back(i.real()*i.real()+i.imag()*i.imag());
+// recognises vowels in audio streams with the classifier in model, a
+// feature row of 100 amplitudes like parse_to_csv writes. With a socket
+// path it listens on a UNIX domain socket there, runs each connection as a
+// session on a pool of workers and writes the events back to it. Without,
+// stdin is the only session and the events go to stdout. The stats go to
+// stderr every statsInterval seconds and at the end of a stdin session.
+int serve(std::string model, std::string socketPath, ServiceConfig config = ServiceConfig()){
+
+    Classifier classifier;
+    if(!classifier.load(model) || classifier.inputs != 100){
+        std::cerr << "can't load " << model << " or it doesn't take 100 amplitudes\n";
+        return 1;
+    }
 
-        return out;
-    };
+    // a reader that went away shows up as a failed write, not a signal.
+    std::signal(SIGPIPE, SIG_IGN);
 
-    auto sinc = [](float x) -> float {
-        if(std::abs(x) < 1e-5) return 1.0f;
-        return std::sin(x*M_PI) / (x*M_PI);
+    ServiceStats stats;
+    auto start = std::chrono::steady_clock::now();
+
+    auto seconds = [&]() -> double {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
     };
 
-    auto sinc2 = [&](float x) -> float {
-        if(std::abs(x) > 3) return 0.0f;
-        float y = sinc(x);
-        return y*y;
+    auto write_all = [](int fd, const std::string &text) -> bool {
+        const char *c = text.data();
+        size_t left = text.size();
+        while(left){
+            ssize_t done = ::write(fd, c, left);
+            if(done < 0 && errno == EINTR) continue;
+            if(done <= 0) return 0;
+            c += done;
+            left -= done;
+        }
+        return 1;
     };
-    
-    auto interpolate_and_normalize = [&](vector<float> in, float pitch) -> vector<float> {
 
-        const float p = 60.0f;
-        vector<float> out(100, 0.0f);
-   
-        assert(in.size()*pitch >= 6000.0f);
+    // reads until the end of the stream. An event's latency is from the read
+    // that completed its hop to the write that sent it.
+    auto run = [&](VowelSession &session, int in, int out) -> void {
 
-        // amplitude
+        stats.sessions++;
+        stats.active++;
+        session.begin();
 
-        for(float &i : in) i = std::sqrt(std::abs(i));
+        // about 25 ms of 16 bit audio at 44.1 kHz, a bigger read would
+        // hold the first events of a full buffer back for longer.
+        std::vector<char> buffer(1 << 12);
+        std::string events;
 
-        for(int i=0, j=0; i<=100; i++){
+        for(;;){
 
-            while((j+1)*pitch < (i+1)*p) j++;
+            ssize_t n = ::read(in, buffer.data(), buffer.size());
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) break;
 
-            float lp = j-1 >= 0 ? in[j-1] : 0.0f;
-            float rp = j < (int)in.size() ? in[j] : 0.0f;
+            auto received = std::chrono::steady_clock::now();
+            stats.bytes += n;
 
-            float l = ((i+1)*p - j*pitch)/pitch;
-            float r = ((j+1)*pitch - (i+1)*p)/pitch;
+            events.clear();
+            int count = session.feed(buffer.data(), n, events, stats);
 
-            out[i] = lp * r + rp * l;
+            // a whole line at once, the other workers write here too.
+            if(count < 0){
+                std::cerr << std::string("closing a session: ") + session.error() + "\n" << std::flush;
+                break;
+            }
+            if(count && !write_all(out, events)) break;
 
-            assert(std::abs(l+r-1) < 1e-5);
-            assert(out[i] >= 0.0f);
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - received).count();
+            stats.add_latency(us, count);
         }
 
-        /*
-        // energy
+        stats.active--;
+    };
 
-        for(int i=0; i<100; i++){
-            for(int j=0; j<(int)in.size(); j++){
-                out[i] += sinc2(((i+1)*p-j*pitch)/pitch) * in[j];
-            }
+    std::atomic<bool> done(0);
+    std::mutex reporting;
+    std::condition_variable stop;
+
+    std::thread reporter([&]{
+        if(config.statsInterval <= 0) return;
+        std::unique_lock<std::mutex> lock(reporting);
+        while(!stop.wait_for(lock, std::chrono::duration<double>(config.statsInterval), [&]{ return (bool)done; })){
+            std::cerr << stats.report(seconds()) << std::endl;
         }
-        */
+    });
 
-        float sum = 0.0f;
-        for(float i : out) sum += i;
+    auto finish = [&](int status) -> int {
+        {
+            std::lock_guard<std::mutex> lock(reporting);
+            done = 1;
+        }
+        stop.notify_all();
+        reporter.join();
+        std::cerr << stats.report(seconds()) << std::endl;
+        return status;
+    };
 
-        const float norm = 10.0f;
-        sum = norm / sum;
+    if(socketPath.empty()){
+        VowelSession session(classifier, config.rawRate);
+        run(session, 0, 1);
+        return finish(0);
+    }
 
-        for(float &i : out) i *= sum;
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
 
-        return out;
-    };
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
 
-    auto get_label = [](std::string s) -> std::string {
-        int n = s.size();
-        int i = n-1;
-        for(; i>=0; i--){ if(s[i] == '/') break; }
-        if(s[i] != '/') return "a";
-        return s.substr(i+2, 1);
-    };
+    if(listener < 0 || socketPath.size() >= sizeof(address.sun_path)) return finish(1);
+    std::strcpy(address.sun_path, socketPath.c_str());
+
+    ::unlink(socketPath.c_str());
+    if(::bind(listener, (sockaddr*)&address, sizeof(address)) || ::listen(listener, 64)){
+        ::close(listener);
+        return finish(1);
+    }
 
-    for(auto f : files){
+    // the classifier keeps its buffers in the object, so every worker has
+    // its own copy.
 
-        iwstream I;
-        if(!I.open(f)) continue;
+    unsigned workers = config.workers ? config.workers : std::max(1u, std::thread::hardware_concurrency());
+    BoundedQueue<int> connections(config.queue);
+    std::vector<std::thread> pool;
 
-        change::Detector detector;
-        vector<float> samples(step);
+    for(unsigned t=0; t<workers; t++){
+        pool.emplace_back([&]{
+            Classifier own = classifier;
+            VowelSession session(own, config.rawRate);
+            for(int fd; (fd = connections.pop()) >= 0;){
+                run(session, fd, fd);
+                ::close(fd);
+            }
+        });
+    }
+
+    // accepting waits while the queue is full, then the kernel's backlog
+    // fills and the clients wait in connect.
 
-        vector<std::pair<vector<float>, float> > all;
+    for(;;){
+        int fd = ::accept(listener, nullptr, nullptr);
+        if(fd < 0){
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        connections.push(fd);
+    }
 
-        while(I.read_move(samples.data(), step) == step){
-            
-            detector.feed(samples);
+    for(unsigned t=0; t<workers; t++) connections.push(-1);
+    for(auto &t : pool) t.join();
 
-            if(detector.voiced && detector.pitch > 80.0f && detector.pitch < 500.0f){
-                
-                unsigned num = (unsigned)std::ceil(6000.0f / detector.pitch);
+    ::close(listener);
+    ::unlink(socketPath.c_str());
 
-                auto freq = math::cos_window_ft(detector.get2(), num);
-                auto e = to_energy(freq);
+    return finish(1);
+}
 
-                float sum = 0.0f;
-                for(auto i : e) sum += i;
+// other tasks (see bench.cpp) include this file for the library part.
+#ifndef PARSER_NO_MAIN
 
-                if(sum > 1e-3) all.push_back({e, detector.pitch});
-            }
-        }
+// parser [directory output N] [--seed s] [--npy] [--feature name]...
+//        [--shard i/k] [--merge k] [--sync]
+// parser --classify model input.csv
+// parser --serve model [--socket path] [--workers n] [--queue n] [--rate hz] [--stats s]
+// --shard i/k parses the i-th of k shards to output.i-of-k, --merge k joins
+// the k shards of output into output. --classify prints the labels a model
+// from export_model.py gives the rows of a feature csv. --serve runs the
+// vowel service with it on stdin or a UNIX socket, see serve.
+int main(int argc, char **argv){
 
-        if(all.size() < N) continue;
+    std::string directory = "../dataset", output = "../training1";
+    unsigned N = 10;
 
-        std::shuffle(all.begin(), all.end(), rng32);
+    uint64_t seed = 0;
+    Format format = Format::csv;
+    std::vector<Feature> features;
+    Shard shard;
+    unsigned merge = 0, threads = 0;
+    bool sync = 0;
+    std::string cache, tracks;
+
+    std::string model, socketPath;
+    ServiceConfig service;
+
+    std::vector<std::string> positional;
+
+    auto usage = []() -> int {
+        std::cerr << "usage: parser [directory output N] [--seed s] [--npy] [--feature name]..."
+            " [--shard i/k] [--merge k] [--sync]\n"
+            "              [--threads n] [--cache file] [--tracks file]\n"
+            "       parser --classify model input.csv\n"
+            "       parser --serve model [--socket path] [--workers n] [--queue n] [--rate hz] [--stats s]\n";
+        return 1;
+    };
 
-        auto label = get_label(f);
+    // the numbers must be whole arguments, stoull alone takes "12abc" as 12.
+    // Throws invalid_argument with the argument.
+    auto number = [](const char *s) -> unsigned long long {
+        size_t end = 0;
+        unsigned long long x = 0;
+        try { x = std::stoull(s, &end); } catch(const std::exception&) { end = 0; }
+        if(end == 0 || s[end] || *s == '-') throw std::invalid_argument(s);
+        return x;
+    };
+    auto decimal = [](const char *s) -> double {
+        size_t end = 0;
+        double x = 0;
+        try { x = std::stod(s, &end); } catch(const std::exception&) { end = 0; }
+        if(end == 0 || s[end]) throw std::invalid_argument(s);
+        return x;
+    };
 
-        for(unsigned i=0; i<N; i++){
-            auto out = interpolate_and_normalize(all[i].first, all[i].second);
-            for(float i : out) assert(!std::isnan(i) && !std::isinf(i));
-            for(int j=0; j<99; j++) spectrums << out[j] << ',';
-            spectrums << out[99] << '\n';
-            labels << label << '\n';
-        }
+    try {
+
+    for(int i=1; i<argc; i++){
+
+        std::string a = argv[i];
+        bool more = i+1 < argc;
 
-        std::cerr << f << ' ' << label << '\n';
-        labels.flush();
-        spectrums.flush();
+        if(a == "--seed" && more) seed = number(argv[++i]);
+        else if(a == "--npy") format = Format::npy;
+        else if(a == "--feature" && more){
+            std::string name = argv[++i];
+            unsigned k = 0;
+            for(; k<3 && feature_name((Feature)k) != name; k++);
+            if(k == 3){
+                std::cerr << "unknown feature " << name << '\n';
+                return 1;
+            }
+            features.push_back((Feature)k);
+        }
+        else if(a == "--shard" && more){
+            std::string arg = argv[++i];
+            size_t slash = arg.find('/');
+            if(slash == std::string::npos){
+                std::cerr << "--shard takes i/k with i < k\n";
+                return 1;
+            }
+            unsigned long long index = number(arg.substr(0, slash).c_str());
+            unsigned long long count = number(arg.substr(slash + 1).c_str());
+            if(index >= count || count > UINT32_MAX){
+                std::cerr << "--shard takes i/k with i < k\n";
+                return 1;
+            }
+            shard.index = index;
+            shard.count = count;
+        }
+        else if(a == "--merge" && more) merge = number(argv[++i]);
+        else if(a == "--sync") sync = 1;
+        else if(a == "--threads" && more) threads = number(argv[++i]);
+        else if(a == "--cache" && more) cache = argv[++i];
+        else if(a == "--tracks" && more) tracks = argv[++i];
+        else if(a == "--serve" && more) model = argv[++i];
+        else if(a == "--socket" && more) socketPath = argv[++i];
+        else if(a == "--workers" && more) service.workers = number(argv[++i]);
+        else if(a == "--queue" && more) service.queue = number(argv[++i]);
+        else if(a == "--rate" && more) service.rawRate = number(argv[++i]);
+        else if(a == "--stats" && more) service.statsInterval = decimal(argv[++i]);
+        else if(a == "--classify" && i+2 < argc){
+            std::string model = argv[++i];
+            return classify_csv(model, argv[++i]);
+        }
+        else if(a.compare(0, 2, "--") != 0) positional.push_back(a);
+        else return usage();
     }
 
-    return 0;
-}
+    if(positional.size() == 3){
+        directory = positional[0];
+        output = positional[1];
+        N = number(positional[2].c_str());
+    }
+    else if(!positional.empty()){
+        std::cerr << "give the directory, the output and N, or none of them\n";
+        return 1;
+    }
 
-int main(){
+    }
+    catch(const std::invalid_argument &e){
+        std::cerr << "not a number: " << e.what() << '\n';
+        return usage();
+    }
 
-    std::string directory = "../dataset", output = "../training1";
-    unsigned N = 10;
+    if(!model.empty()) return serve(model, socketPath, service);
 
-    // std::cin >> directory >> output >> N;
+    if(features.empty()) features.push_back(Feature::amplitude);
 
-    parse_to_csv(directory, output, N);
+    if(merge) return merge_shards(output, merge, format, features);
 
-    return 0;
+    return parse_to_csv(directory, shard_output(output, shard), N, format, threads, seed,
+            cache, tracks, features, shard, sync);
 }
+
+#endif  // PARSER_NO_MAIN
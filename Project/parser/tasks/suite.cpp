@@ -0,0 +1,431 @@
+#define PARSER_NO_MAIN
+#define COUNT_ALLOCATIONS
+#include "parser.cpp"
+
+/*****************************************************************************/
+// benchmark suite ////////////////////////////////////////////////////////////
+/*****************************************************************************/
+
+// every hot kernel of the parser timed the same way, with the results as
+// json so runs can be kept and compared. bench.cpp is for looking at one
+// change, this is for catching regressions. Compile it like the parser
+// (dev/compile suite) so the numbers use the same flags.
+//
+// suite [output.json] [--filter text] [--compare baseline.json] [--tolerance 0.1]
+//
+// Each benchmark is warmed up, then the number of calls per sample is
+// doubled until a sample takes 5 ms, and 15 samples are taken. The json has
+// the mean, median, minimum, standard deviation and variance of the time
+// per call, the items (samples, values, files) and bytes per second and the
+// allocations per call. With a baseline the medians are compared and the
+// exit code is 1 when one got slower by more than the tolerance and by more
+// than 3 standard errors of the difference, from the standard deviations and
+// samples of both runs, so a noisy benchmark doesn't show up as a regression.
+
+namespace suite {
+
+using std::vector;
+using std::string;
+
+struct Result {
+    string name;
+    uint64_t iterations = 0;
+    unsigned samples = 0;
+    double mean = 0, median = 0, min = 0, stddev = 0, variance = 0;
+    double itemsPerSecond = 0, bytesPerSecond = 0, allocations = 0;
+};
+
+vector<Result> results;
+string filter;
+
+// results are accumulated here so the timed calls can't be optimized away.
+volatile float sink = 0;
+
+// items and bytes are what one call of f processes, 0 if it doesn't apply.
+// a call of f can do several ops, the times are per op.
+template<class F>
+void measure(string name, double items, double bytes, F f, unsigned ops = 1){
+
+    if(!filter.empty() && name.find(filter) == string::npos) return;
+
+    using clock = std::chrono::steady_clock;
+
+    auto run = [&](uint64_t n) -> double {
+        auto begin = clock::now();
+        for(uint64_t i=0; i<n; i++) f();
+        return std::chrono::duration<double, std::nano>(clock::now() - begin).count();
+    };
+
+    f();
+
+    uint64_t n = 1;
+    while(run(n) < 5e6 && n < (1ull << 30)) n *= 2;
+
+    const unsigned samples = 15;
+    vector<double> ns(samples);
+
+    uint64_t allocations = debug::allocations;
+    for(unsigned s=0; s<samples; s++) ns[s] = run(n) / (n * ops);
+    allocations = debug::allocations - allocations;
+
+    Result r;
+    r.name = name;
+    r.iterations = n;
+    r.samples = samples;
+
+    for(double t : ns) r.mean += t / samples;
+    for(double t : ns) r.variance += (t - r.mean) * (t - r.mean) / (samples - 1);
+    r.stddev = std::sqrt(r.variance);
+
+    std::sort(ns.begin(), ns.end());
+    r.median = ns[samples / 2];
+    r.min = ns[0];
+
+    r.itemsPerSecond = items * 1e9 / (r.median * ops);
+    r.bytesPerSecond = bytes * 1e9 / (r.median * ops);
+    r.allocations = (double)allocations / (n * samples * ops);
+
+    std::cerr << std::left << std::setw(40) << name << std::right << std::setw(14)
+        << std::fixed << std::setprecision(1) << r.median << " ns  +-" << std::setprecision(1)
+        << 100 * r.stddev / r.mean << "%  " << std::setprecision(2) << r.allocations << " allocs\n";
+
+    results.push_back(r);
+}
+
+// the synthetic voice of bench.cpp: harmonics with 1/k amplitudes, the
+// pitch gliding from f0 to f1, and a little noise.
+vector<float> voice(unsigned rate, float f0, float f1, float seconds, unsigned seed = 1337){
+
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+
+    unsigned n = rate * seconds;
+    vector<float> waves(n);
+
+    double phase = 0.0;
+    for(unsigned i=0; i<n; i++){
+        float f = f0 + (f1 - f0) * i / n;
+        phase += f / rate;
+        float x = 0.0f;
+        for(unsigned k=1; k<=10; k++) x += std::sin(2.0 * PI * k * phase) / k;
+        waves[i] = 0.2f * x + noise(rng);
+    }
+
+    return waves;
+}
+
+// a 16 bit mono wave file of waves.
+bool write_wave(const string &path, const vector<float> &waves, unsigned rate){
+
+    const unsigned dataSize = waves.size() * 2;
+    vector<char> bytes(44 + dataSize);
+    char *c = bytes.data();
+
+    std::memcpy(c, "RIFF", 4);
+    wave_dialog::say_uint32(36 + dataSize, c + 4);
+    std::memcpy(c + 8, "WAVEfmt ", 8);
+    wave_dialog::say_uint32(16, c + 16);
+    wave_dialog::say_uint16(1, c + 20);
+    wave_dialog::say_uint16(1, c + 22);
+    wave_dialog::say_uint32(rate, c + 24);
+    wave_dialog::say_uint32(rate * 2, c + 28);
+    wave_dialog::say_uint16(2, c + 32);
+    wave_dialog::say_uint16(16, c + 34);
+    std::memcpy(c + 36, "data", 4);
+    wave_dialog::say_uint32(dataSize, c + 40);
+
+    for(unsigned i=0; i<waves.size(); i++) wave_dialog::say_float_as_int16(waves[i], c + 44 + 2*i);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+    return out.good();
+}
+
+void decoders(){
+
+    const unsigned n = 1 << 16;
+
+    std::mt19937 rng(3);
+    vector<char> bytes(4 * n);
+    for(char &b : bytes) b = rng();
+
+    vector<float> out(n);
+
+    auto decoder = [&](string name, unsigned size, float (*listen)(const char*)){
+        measure("wave_dialog/" + name, n, (double)n * size, [&]{
+            for(unsigned i=0; i<n; i++) out[i] = listen(bytes.data() + i*size);
+            sink = sink + out[n/2];
+        });
+    };
+
+    decoder("int8", 1, wave_dialog::listen_int8_as_float);
+    decoder("int16", 2, wave_dialog::listen_int16_as_float);
+    decoder("int24", 3, wave_dialog::listen_int24_as_float);
+    decoder("int32", 4, wave_dialog::listen_int32_as_float);
+    decoder("float32", 4, wave_dialog::listen_float32);
+}
+
+void reader(const string &path, unsigned samples){
+
+    for(unsigned block : {128u, 1024u, 8192u, 65536u}){
+
+        vector<float> out(block);
+
+        measure("iwstream/read_move/" + std::to_string(block), samples, samples * 2.0, [&]{
+            iwstream I(path);
+            for(unsigned at = 0; at < samples; at += block) I.read_move(out.data(), block);
+            sink = sink + out[0];
+        });
+    }
+
+    vector<float> all;
+    measure("iwstream/read_file", samples, samples * 2.0, [&]{
+        iwstream I(path);
+        all.clear();
+        I.read_file(all);
+        sink = sink + all[0];
+    });
+}
+
+void ffts(){
+
+    std::mt19937 rng(5);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+
+    for(unsigned n : {256u, 1024u, 4096u, 16384u, 65536u, 1000u, 4410u, 12000u}){
+
+        vector<std::complex<float>> v(n);
+        for(auto &x : v) x = {normal(rng), normal(rng)};
+
+        bool power = (n & (n-1)) == 0;
+        string name = string("math/in_place_fft/") + (power ? "" : "bluestein/") + std::to_string(n);
+
+        // forward and back, so the values stay bounded.
+        measure(name, 2.0 * n, 0, [&]{
+            math::in_place_fft(v.data(), n);
+            math::in_place_fft(v.data(), n, 1);
+            sink = sink + v[0].real();
+        });
+    }
+}
+
+void correlations(){
+
+    std::mt19937 rng(7);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+
+    // the detector's sizes at 44.1 kHz, 60 - 900 Hz: size 1470, max 735.
+    for(unsigned n : {735u, 1470u, 2940u}){
+
+        vector<float> a(n), b(n);
+        for(float &x : a) x = normal(rng);
+        for(float &x : b) x = normal(rng);
+
+        vector<float> r(n), ra(n), rb(n);
+        vector<std::complex<float>> work(std::max(math::correlation_size(n, n), math::autocorrelation_size(n, n)));
+
+        measure("math/correlation/" + std::to_string(n), n, 0, [&]{
+            math::correlation(a.data(), n, b.data(), n, r.data(), n, work.data());
+            sink = sink + r[0];
+        });
+
+        measure("math/autocorrelation/" + std::to_string(n), 2.0 * n, 0, [&]{
+            math::autocorrelation(a.data(), n, b.data(), n, ra.data(), rb.data(), work.data());
+            sink = sink + ra[0] + rb[0];
+        });
+    }
+}
+
+void spectra(const vector<float> &waves){
+
+    // two periods of the voice, as parse_to_csv takes them, up to 6 kHz,
+    // into the buffers of a worker.
+    math::WindowedFT work;
+
+    for(float pitch : {100.0f, 200.0f, 400.0f}){
+
+        unsigned size = 2 * std::lrint(44100 / pitch);
+        unsigned n = std::ceil(6000.0f / pitch);
+
+        measure("math/cos_window_ft/" + std::to_string((int)pitch) + "Hz", n, 0, [&]{
+            auto &f = math::cos_window_ft(work, waves.data() + 10000, size, n);
+            sink = sink + f[0].real();
+        });
+    }
+}
+
+void detector(const vector<float> &waves){
+
+    for(unsigned hop : {64u, 128u, 256u, 512u}){
+
+        change::Detector d(44100);
+        vector<float> chunk(hop);
+        unsigned at = 0;
+
+        measure("change/Detector/feed/" + std::to_string(hop), hop, 0, [&]{
+            if(at + hop > waves.size()) at = 0;
+            std::copy(waves.begin() + at, waves.begin() + at + hop, chunk.begin());
+            d.feed(chunk);
+            at += hop;
+            sink = sink + d.pitch;
+        });
+    }
+}
+
+void pipeline(const string &directory, unsigned files, unsigned samples){
+
+    string output = (std::filesystem::path(directory) / "out").string();
+
+    // the whole of parse_to_csv on one thread, without its report.
+    measure("parse_to_csv/file", files, files * samples * 2.0, [&]{
+        std::streambuf *log = std::cerr.rdbuf(nullptr);
+        sink = sink + parse_to_csv(directory, output, 10, Format::csv, 1, 1);
+        std::cerr.rdbuf(log);
+    }, files);
+}
+
+string to_json(const string &flags){
+
+    std::ostringstream o;
+    o << std::setprecision(6);
+
+    o << "{\n"
+        << "  \"suite\": \"parser\",\n"
+        << "  \"compiler\": " << json_string(__VERSION__) << ",\n"
+        << "  \"flags\": " << json_string(flags) << ",\n"
+        << "  \"time\": " << std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count() << ",\n"
+        << "  \"results\": [";
+
+    // one result per line, compare reads them back that way.
+    for(unsigned i=0; i<results.size(); i++){
+        const Result &r = results[i];
+        o << (i ? "," : "") << "\n    {\"name\": " << json_string(r.name)
+            << ", \"ns_median\": " << r.median << ", \"ns_mean\": " << r.mean
+            << ", \"ns_min\": " << r.min << ", \"ns_stddev\": " << r.stddev
+            << ", \"ns_variance\": " << r.variance
+            << ", \"items_per_second\": " << r.itemsPerSecond
+            << ", \"bytes_per_second\": " << r.bytesPerSecond
+            << ", \"allocations_per_op\": " << r.allocations
+            << ", \"iterations\": " << r.iterations << ", \"samples\": " << r.samples << "}";
+    }
+
+    o << "\n  ]\n}\n";
+    return o.str();
+}
+
+// the results of a json this wrote by name, only the times compare uses.
+std::map<string, Result> read_results(const string &path){
+
+    std::map<string, Result> results;
+    std::ifstream in(path);
+
+    const string nameKey = "{\"name\": \"";
+    const string keys[] = {"\"ns_median\": ", "\"ns_stddev\": ", "\"samples\": "};
+
+    for(string line; std::getline(in, line);){
+
+        size_t a = line.find(nameKey), at[3];
+        for(unsigned k=0; k<3; k++) at[k] = line.find(keys[k]);
+        if(a == string::npos || at[0] == string::npos || at[1] == string::npos || at[2] == string::npos) continue;
+
+        a += nameKey.size();
+        Result &r = results[line.substr(a, line.find('"', a) - a)];
+        r.median = std::stod(line.substr(at[0] + keys[0].size()));
+        r.stddev = std::stod(line.substr(at[1] + keys[1].size()));
+        r.samples = std::stoul(line.substr(at[2] + keys[2].size()));
+    }
+
+    return results;
+}
+
+}   // namespace suite
+
+int main(int argc, char **argv){
+
+    using namespace suite;
+
+    string output, baseline;
+    double tolerance = 0.1;
+
+    for(int i=1; i<argc; i++){
+        string a = argv[i];
+        if(a == "--filter" && i+1 < argc) filter = argv[++i];
+        else if(a == "--compare" && i+1 < argc) baseline = argv[++i];
+        else if(a == "--tolerance" && i+1 < argc) tolerance = std::stod(argv[++i]);
+        else if(a.compare(0, 2, "--") != 0) output = a;
+        else {
+            std::cerr << "usage: suite [output.json] [--filter text] [--compare baseline.json]"
+                " [--tolerance 0.1]\n";
+            return 1;
+        }
+    }
+
+    // the test data: a voice, written as wave files for the reader and
+    // the pipeline, named so the label is their second letter.
+
+    const unsigned rate = 44100;
+    auto waves = voice(rate, 110.0f, 330.0f, 2.0f);
+
+    auto directory = std::filesystem::temp_directory_path() / ("parser_suite_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(directory);
+
+    const unsigned files = 4;
+    for(unsigned i=0; i<files; i++){
+        string name = string("x") + "aeiou"[i % 5] + "_" + std::to_string(i) + ".wav";
+        write_wave((directory / name).string(), voice(rate, 100.0f + 40*i, 140.0f + 40*i, 1.0f, i), rate);
+    }
+
+    string wave = (directory / "xa_0.wav").string();
+
+    decoders();
+    reader(wave, rate);
+    ffts();
+    correlations();
+    spectra(waves);
+    detector(waves);
+    pipeline(directory.string(), files, rate);
+
+    std::filesystem::remove_all(directory);
+
+    string flags;
+#ifdef __AVX2__
+    flags += "avx2 ";
+#endif
+#ifdef __FMA__
+    flags += "fma ";
+#endif
+#ifdef __OPTIMIZE__
+    flags += "optimized";
+#endif
+
+    string json = to_json(flags);
+
+    if(output.empty()) std::cout << json;
+    else {
+        std::ofstream out(output);
+        out << json;
+        if(!out) return 1;
+    }
+
+    if(baseline.empty()) return 0;
+
+    auto before = read_results(baseline);
+    unsigned regressions = 0;
+
+    for(const Result &r : results){
+        auto it = before.find(r.name);
+        if(it == before.end()) continue;
+        const Result &b = it->second;
+        double ratio = r.median / b.median;
+
+        // the standard error of a median is about 1.25 of the mean's.
+        double error = 1.25 * std::sqrt(r.variance / r.samples + b.stddev * b.stddev / std::max(1u, b.samples));
+        bool slower = r.median - b.median > std::max(tolerance * b.median, 3 * error);
+        regressions += slower;
+        std::cerr << std::left << std::setw(40) << r.name << std::right << std::fixed
+            << std::setprecision(2) << std::setw(8) << ratio << "x" << (slower ? "  SLOWER" : "") << '\n';
+    }
+
+    return regressions ? 1 : 0;
+}